@@ -0,0 +1,155 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 16
+#define SEG_ARRAY_FIRST_CAPACITY 64
+
+static struct arena_block *arena_block_new(struct arena *arena, size_t size)
+{
+    struct arena_block *block;
+    if (!(block = malloc(sizeof(*block) + size)))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+
+    arena->allocations++;
+    return block;
+}
+
+void arena_init(struct arena *arena, size_t block_size)
+{
+    arena->blocks = NULL;
+    arena->block_size = block_size;
+    arena->allocations = 0;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+
+    struct arena_block *block = arena->blocks;
+    if (!block || block->size - block->used < size)
+    {
+        size_t block_size = arena->block_size;
+        while (block_size < size)
+            block_size *= 2;
+
+        block = arena_block_new(arena, block_size);
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void arena_reset(struct arena *arena)
+{
+    if (!arena->blocks)
+        return;
+
+    // More than one block was required, replace them with a single block that fits everything,
+    // so after a few resets the arena doesn't allocate anymore.
+    if (arena->blocks->next)
+    {
+        size_t total = 0;
+        for (struct arena_block *block = arena->blocks; block; block = block->next)
+            total += block->size;
+
+        arena_free(arena);
+        arena->block_size = total;
+        arena->blocks = arena_block_new(arena, total);
+    }
+
+    arena->blocks->used = 0;
+}
+
+void arena_free(struct arena *arena)
+{
+    struct arena_block *block = arena->blocks;
+    while (block)
+    {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
+
+void seg_array_init(struct seg_array *array, size_t elem_size)
+{
+    array->elem_size = elem_size;
+    array->count = 0;
+    array->segments_count = 0;
+    array->allocations = 0;
+}
+
+void *seg_array_push(struct seg_array *array)
+{
+    struct seg_array_segment *segment = NULL;
+    if (array->segments_count > 0)
+        segment = &array->segments[array->segments_count - 1];
+
+    if (!segment || segment->count == segment->capacity)
+    {
+        if (array->segments_count == SEG_ARRAY_MAX_SEGMENTS)
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+
+        size_t capacity = segment ? 2 * segment->capacity : SEG_ARRAY_FIRST_CAPACITY;
+
+        segment = &array->segments[array->segments_count++];
+        if (!(segment->data = malloc(capacity * array->elem_size)))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+        segment->count = 0;
+        segment->capacity = capacity;
+        array->allocations++;
+    }
+
+    array->count++;
+    return segment->data + (segment->count++) * array->elem_size;
+}
+
+void *seg_array_at(const struct seg_array *array, size_t i)
+{
+    // Segment k holds SEG_ARRAY_FIRST_CAPACITY * 2^k elements
+    size_t block = i / SEG_ARRAY_FIRST_CAPACITY + 1;
+    int k = 0;
+    while (block >>= 1)
+        k++;
+
+    size_t offset = i - SEG_ARRAY_FIRST_CAPACITY * (((size_t) 1 << k) - 1);
+    return array->segments[k].data + offset * array->elem_size;
+}
+
+void seg_array_copy_to(const struct seg_array *array, void *dst)
+{
+    char *p = dst;
+    for (int i = 0; i < array->segments_count; ++i)
+    {
+        const struct seg_array_segment *segment = &array->segments[i];
+        memcpy(p, segment->data, segment->count * array->elem_size);
+        p += segment->count * array->elem_size;
+    }
+}
+
+void seg_array_free(struct seg_array *array)
+{
+    for (int i = 0; i < array->segments_count; ++i)
+        free(array->segments[i].data);
+    array->segments_count = 0;
+    array->count = 0;
+}
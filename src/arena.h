@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+
+// Bump allocator for temporaries, freed all at once.
+struct arena_block
+{
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    _Alignas(16) char data[];
+};
+
+struct arena
+{
+    struct arena_block *blocks;
+    size_t block_size;
+    // Number of blocks ever allocated, for statistics.
+    unsigned long long allocations;
+};
+
+void arena_init(struct arena *arena, size_t block_size);
+
+// Allocate size bytes, aligned to 16 bytes, valid until the next reset.
+void *arena_alloc(struct arena *arena, size_t size);
+
+// Free everything allocated since the last reset, keeping the memory for reuse.
+void arena_reset(struct arena *arena);
+
+void arena_free(struct arena *arena);
+
+#define SEG_ARRAY_MAX_SEGMENTS 48
+
+struct seg_array_segment
+{
+    char *data;
+    size_t count;
+    size_t capacity;
+};
+
+// Growable array stored in segments of doubling capacity, so elements are never moved or
+// copied when it grows.
+struct seg_array
+{
+    size_t elem_size;
+    size_t count;
+    int segments_count;
+    struct seg_array_segment segments[SEG_ARRAY_MAX_SEGMENTS];
+    // Number of segments ever allocated, for statistics.
+    unsigned long long allocations;
+};
+
+void seg_array_init(struct seg_array *array, size_t elem_size);
+
+// Append an element, returns its (uninitialized) storage.
+void *seg_array_push(struct seg_array *array);
+
+// Get the element at index i.
+void *seg_array_at(const struct seg_array *array, size_t i);
+
+// Copy all the elements, in order, to a contiguous array.
+void seg_array_copy_to(const struct seg_array *array, void *dst);
+
+void seg_array_free(struct seg_array *array);
@@ -0,0 +1,155 @@
+#include "cluster.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// A face starts a new cluster when its normal differs more than this from the ones before (cosine).
+#define CLUSTER_MIN_NORMAL_COS 0.7
+// Faces whose normals are this close to be perpendicular to the view are left to the per-face test.
+#define CLUSTER_CONE_MARGIN 0.01
+
+static void cluster_finish(struct face_cluster *cluster, const struct model *model)
+{
+    // Bounding sphere centered in the bounding box
+    vec3 min = model->vertexes[model->faces[cluster->first_face].idxs[0]];
+    vec3 max = min;
+    for (unsigned int f = cluster->first_face; f < cluster->end_face; ++f)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            vec3 v = model->vertexes[model->faces[f].idxs[k]];
+            min.x = fminf(min.x, v.x);
+            min.y = fminf(min.y, v.y);
+            min.z = fminf(min.z, v.z);
+            max.x = fmaxf(max.x, v.x);
+            max.y = fmaxf(max.y, v.y);
+            max.z = fmaxf(max.z, v.z);
+        }
+    }
+    cluster->center = (vec3){(min.x + max.x) / 2, (min.y + max.y) / 2, (min.z + max.z) / 2};
+    cluster->radius = 0;
+    for (unsigned int f = cluster->first_face; f < cluster->end_face; ++f)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            vec3 v = model->vertexes[model->faces[f].idxs[k]];
+            cluster->radius = fmaxf(cluster->radius, vec3_mag(vec3_sub(v, cluster->center)));
+        }
+    }
+
+    // Normal cone around the mean normal. Degenerate faces have a zero normal, that leaves the
+    // cone open.
+    vec3 axis = {0, 0, 0};
+    for (unsigned int f = cluster->first_face; f < cluster->end_face; ++f)
+        axis = vec3_add(axis, model->normals[f]);
+    axis = vec3_normalize(axis);
+
+    float min_cos = 1;
+    for (unsigned int f = cluster->first_face; f < cluster->end_face; ++f)
+        min_cos = fminf(min_cos, vec3_dot_product(axis, model->normals[f]));
+
+    cluster->cone_axis = axis;
+    if (min_cos > 0)
+        cluster->cone_cutoff = sqrtf(1 - min_cos * min_cos) + CLUSTER_CONE_MARGIN;
+    else
+        cluster->cone_cutoff = 2;
+}
+
+// Add the node of the clusters in [first, end) and its children, returns the index of the node.
+static unsigned int cluster_node_build(struct model *model, unsigned int first, unsigned int end)
+{
+    const struct face_cluster *clusters = model->clusters;
+
+    // Sphere centered in the bounding box of the spheres of the clusters
+    vec3 min = clusters[first].center;
+    vec3 max = clusters[first].center;
+    for (unsigned int k = first; k < end; ++k)
+    {
+        vec3 c = clusters[k].center;
+        float r = clusters[k].radius;
+        min.x = fminf(min.x, c.x - r);
+        min.y = fminf(min.y, c.y - r);
+        min.z = fminf(min.z, c.z - r);
+        max.x = fmaxf(max.x, c.x + r);
+        max.y = fmaxf(max.y, c.y + r);
+        max.z = fmaxf(max.z, c.z + r);
+    }
+    vec3 center = {(min.x + max.x) / 2, (min.y + max.y) / 2, (min.z + max.z) / 2};
+    float radius = 0;
+    for (unsigned int k = first; k < end; ++k)
+        radius = fmaxf(radius, vec3_mag(vec3_sub(clusters[k].center, center)) + clusters[k].radius);
+
+    unsigned int index = model->cluster_nodes_count++;
+    if (end - first > 1)
+    {
+        unsigned int mid = first + (end - first) / 2;
+        cluster_node_build(model, first, mid);
+        cluster_node_build(model, mid, end);
+    }
+
+    struct cluster_node *node = &model->cluster_nodes[index];
+    node->first_cluster = first;
+    node->end_cluster = end;
+    node->skip = model->cluster_nodes_count;
+    node->center = center;
+    node->radius = radius;
+    return index;
+}
+
+void model_compute_clusters(struct model *model, unsigned int first_face)
+{
+    unsigned int capacity = model->clusters_count;
+
+    // The faces are not reordered, consecutive faces are usually close in the files
+    unsigned int f = first_face;
+    while (f < model->faces_count)
+    {
+        if (model->clusters_count == capacity)
+        {
+            capacity = 2 * capacity + 16;
+            if (!(model->clusters = realloc(model->clusters, capacity * sizeof(*model->clusters))))
+            {
+                fprintf(stderr, "ERROR: Memory allocation failure.\n");
+                exit(1);
+            }
+        }
+        struct face_cluster *cluster = &model->clusters[model->clusters_count++];
+        cluster->first_face = f;
+
+        vec3 normal_sum = model->normals[f];
+        f++;
+        while (f < model->faces_count && f - cluster->first_face < CLUSTER_MAX_FACES)
+        {
+            vec3 normal = model->normals[f];
+            if (vec3_dot_product(vec3_normalize(normal_sum), normal) < CLUSTER_MIN_NORMAL_COS)
+                break;
+            normal_sum = vec3_add(normal_sum, normal);
+            f++;
+        }
+        cluster->end_face = f;
+
+        cluster_finish(cluster, model);
+    }
+
+    // Without faces no cluster was allocated, so there is nothing to shrink
+    if (model->clusters_count > 0
+            && !(model->clusters = realloc(model->clusters, model->clusters_count * sizeof(*model->clusters))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+
+    // The hierarchy splits the clusters in halves, so it keeps their order
+    model->cluster_nodes_count = 0;
+    if (model->clusters_count == 0)
+        return;
+
+    unsigned int nodes_count = 2 * model->clusters_count - 1;
+    if (!(model->cluster_nodes = realloc(model->cluster_nodes, nodes_count * sizeof(*model->cluster_nodes))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+    cluster_node_build(model, 0, model->clusters_count);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "model.h"
+
+// Largest number of faces in a cluster.
+#define CLUSTER_MAX_FACES 64
+
+// Consecutive faces of a model that are close to each other and have similar normals, so that they
+// can be skipped together when they all face away from the camera.
+struct face_cluster
+{
+    unsigned int first_face, end_face;
+
+    // Bounding sphere of the vertexes of the faces.
+    vec3 center;
+    float radius;
+
+    // The normals of the faces are at most asin(cone_cutoff) away from the axis of the cone, the
+    // cutoff includes a margin for the rounding of the projected faces. It is more than 1 when
+    // the cluster can't be skipped.
+    vec3 cone_axis;
+    float cone_cutoff;
+};
+
+// Node of a bounding volume hierarchy over consecutive clusters, so that the clusters out of view are
+// skipped together. The nodes are stored in depth-first order, the children of a node with more
+// than one cluster follow it.
+struct cluster_node
+{
+    unsigned int first_cluster, end_cluster;
+    // Index of the node after the subtree of this one.
+    unsigned int skip;
+
+    // Bounding sphere of the clusters.
+    vec3 center;
+    float radius;
+};
+
+// Group the faces from first_face on in clusters, the previous ones are kept, and build the
+// hierarchy over all the clusters. Requires the normals of the faces.
+void model_compute_clusters(struct model *model, unsigned int first_face);
+
+// Whether all the faces of the cluster are back faces for an orthographic camera looking in the
+// given direction, in model space.
+static inline bool face_cluster_is_back(const struct face_cluster *cluster, vec3 view_direction)
+{
+    return vec3_dot_product(cluster->cone_axis, view_direction) > cluster->cone_cutoff;
+}
@@ -0,0 +1,122 @@
+#include "compact_model.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMPACT_QUANTIZATION_MAX 32767
+
+// Empty arrays stay NULL, malloc(0) may return NULL and look like a failure.
+static void *compact_alloc(size_t size)
+{
+    if (size == 0)
+        return NULL;
+
+    void *ptr;
+    if (!(ptr = malloc(size)))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+struct compact_model *compact_model_init(const struct model *model)
+{
+    struct compact_model *compact = compact_alloc(sizeof(*compact));
+
+    compact->vertex_count = model->vertex_count;
+    compact->faces_count = model->faces_count;
+
+    // Quantize relative to the largest coordinate, normalized models are inside [-1, 1]^3.
+    float max_coord = 0;
+    for (unsigned int i = 0; i < model->vertex_count; ++i)
+    {
+        vec3 v = model->vertexes[i];
+        max_coord = fmaxf(max_coord, fmaxf(fabsf(v.x), fmaxf(fabsf(v.y), fabsf(v.z))));
+    }
+    compact->scale = max_coord > 0 ? max_coord / COMPACT_QUANTIZATION_MAX : 1;
+
+    compact->positions = compact_alloc(3 * model->vertex_count * sizeof(*compact->positions));
+    for (unsigned int i = 0; i < model->vertex_count; ++i)
+    {
+        vec3 v = model->vertexes[i];
+        compact->positions[3 * i] = lrintf(v.x / compact->scale);
+        compact->positions[3 * i + 1] = lrintf(v.y / compact->scale);
+        compact->positions[3 * i + 2] = lrintf(v.z / compact->scale);
+    }
+
+    compact->idxs16 = NULL;
+    compact->idxs32 = NULL;
+    if (model->vertex_count <= UINT16_MAX + 1)
+    {
+        compact->idxs16 = compact_alloc(3 * model->faces_count * sizeof(*compact->idxs16));
+        for (unsigned int f = 0; f < model->faces_count; ++f)
+        {
+            for (int k = 0; k < 3; ++k)
+                compact->idxs16[3 * f + k] = model->faces[f].idxs[k];
+        }
+    }
+    else
+    {
+        compact->idxs32 = compact_alloc(3 * model->faces_count * sizeof(*compact->idxs32));
+        for (unsigned int f = 0; f < model->faces_count; ++f)
+        {
+            for (int k = 0; k < 3; ++k)
+                compact->idxs32[3 * f + k] = model->faces[f].idxs[k];
+        }
+    }
+
+    // Count the runs first, so they are allocated at once
+    compact->runs_count = 0;
+    for (unsigned int f = 0; f < model->faces_count; ++f)
+    {
+        if (f == 0 || model->faces[f].material != model->faces[f - 1].material)
+            compact->runs_count++;
+    }
+
+    compact->runs = compact_alloc(compact->runs_count * sizeof(*compact->runs));
+    unsigned int r = 0;
+    for (unsigned int f = 0; f < model->faces_count; ++f)
+    {
+        if (f > 0 && model->faces[f].material != model->faces[f - 1].material)
+            r++;
+        compact->runs[r].end_face = f + 1;
+        compact->runs[r].material = model->faces[f].material;
+    }
+
+    compact->clusters_count = model->clusters_count;
+    compact->clusters = compact_alloc(compact->clusters_count * sizeof(*compact->clusters));
+    if (compact->clusters_count > 0)
+        memcpy(compact->clusters, model->clusters, compact->clusters_count * sizeof(*compact->clusters));
+    compact->cluster_nodes_count = model->cluster_nodes_count;
+    compact->cluster_nodes = compact_alloc(compact->cluster_nodes_count * sizeof(*compact->cluster_nodes));
+    if (compact->cluster_nodes_count > 0)
+        memcpy(compact->cluster_nodes, model->cluster_nodes,
+                compact->cluster_nodes_count * sizeof(*compact->cluster_nodes));
+
+    return compact;
+}
+
+void compact_model_free(struct compact_model *compact)
+{
+    free(compact->positions);
+    free(compact->idxs16);
+    free(compact->idxs32);
+    free(compact->runs);
+    free(compact->clusters);
+    free(compact->cluster_nodes);
+    free(compact);
+}
+
+size_t compact_model_bytes(const struct compact_model *compact)
+{
+    size_t idx_size = compact->idxs16 ? sizeof(*compact->idxs16) : sizeof(*compact->idxs32);
+
+    return 3 * compact->vertex_count * sizeof(*compact->positions)
+            + 3 * compact->faces_count * idx_size
+            + compact->runs_count * sizeof(*compact->runs)
+            + compact->clusters_count * sizeof(*compact->clusters)
+            + compact->cluster_nodes_count * sizeof(*compact->cluster_nodes);
+}
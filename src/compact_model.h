@@ -0,0 +1,58 @@
+#pragma once
+
+#include "cluster.h"
+#include "model.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Read-only copy of a model, about half its size: positions quantized to 16 bits, indexes of
+// 16 bits when there are few vertexes and the materials stored as runs of faces.
+struct material_run
+{
+    // The faces from the end of the previous run up to this one (excluded) use the material.
+    unsigned int end_face;
+    int material;
+};
+
+struct compact_model
+{
+    unsigned int vertex_count;
+    unsigned int faces_count;
+
+    // Each coordinate is its quantized value times the scale.
+    float scale;
+    int16_t *positions;
+
+    // Three per face, only one of the arrays is used.
+    uint16_t *idxs16;
+    uint32_t *idxs32;
+
+    unsigned int runs_count;
+    struct material_run *runs;
+
+    // Copy of the clusters of the model and their hierarchy.
+    unsigned int clusters_count;
+    struct face_cluster *clusters;
+    unsigned int cluster_nodes_count;
+    struct cluster_node *cluster_nodes;
+};
+
+struct compact_model *compact_model_init(const struct model *model);
+
+void compact_model_free(struct compact_model *compact);
+
+// Memory used by the vertexes, faces, runs and clusters.
+size_t compact_model_bytes(const struct compact_model *compact);
+
+static inline vec3 compact_model_vertex(const struct compact_model *compact, unsigned int i)
+{
+    const int16_t *q = &compact->positions[3 * i];
+    return (vec3){q[0] * compact->scale, q[1] * compact->scale, q[2] * compact->scale};
+}
+
+// Index i of the flattened faces (3 * face + corner).
+static inline unsigned int compact_model_idx(const struct compact_model *compact, unsigned int i)
+{
+    return compact->idxs16 ? compact->idxs16[i] : compact->idxs32[i];
+}
@@ -0,0 +1,559 @@
+#include "decompress.h"
+
+#include "mapped_file.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+// Size of the blocks handed to the parser, a line longer than this makes its block bigger.
+#define DECOMPRESS_BLOCK_SIZE (1 << 22)
+
+// Maximum input or output handed to zlib at once, as it uses 32 bit sizes.
+#define ZLIB_MAX_STEP (1u << 30)
+
+struct decoder
+{
+    const char *fname;
+    enum compression compression;
+    struct mapped_file file;
+    size_t in_pos;
+    bool done;
+#ifdef WITH_ZLIB
+    z_stream zlib;
+#endif
+#ifdef WITH_ZSTD
+    ZSTD_DStream *zstd;
+#endif
+};
+
+static bool has_extension(const char *fname, const char *ext)
+{
+    size_t len = strlen(fname);
+    size_t ext_len = strlen(ext);
+    if (len <= ext_len || fname[len - ext_len - 1] != '.')
+        return false;
+
+    for (size_t i = 0; i < ext_len; ++i)
+    {
+        if (tolower(fname[len - ext_len + i]) != ext[i])
+            return false;
+    }
+    return true;
+}
+
+enum compression compression_from_filename(const char *fname)
+{
+    if (has_extension(fname, "gz"))
+        return COMPRESSION_GZIP;
+    if (has_extension(fname, "zst"))
+        return COMPRESSION_ZSTD;
+    return COMPRESSION_NONE;
+}
+
+size_t compression_strip_extension(const char *fname)
+{
+    size_t len = strlen(fname);
+    switch (compression_from_filename(fname))
+    {
+        case COMPRESSION_GZIP:
+            return len - 3;
+        case COMPRESSION_ZSTD:
+            return len - 4;
+        default:
+            return len;
+    }
+}
+
+static bool decoder_check_magic(const struct decoder *dec)
+{
+    const unsigned char *data = (const unsigned char *) dec->file.data;
+    size_t size = dec->file.size;
+
+    if (dec->compression == COMPRESSION_GZIP)
+        return size >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+    else
+        return size >= 4 && data[0] == 0x28 && data[1] == 0xb5 && data[2] == 0x2f && data[3] == 0xfd;
+}
+
+static bool decoder_open(struct decoder *dec, const char *fname, enum compression compression)
+{
+    dec->fname = fname;
+    dec->compression = compression;
+    dec->in_pos = 0;
+    dec->done = false;
+
+    if (!mapped_file_open(&dec->file, fname, false))
+    {
+        fprintf(stderr, "ERROR: failed to load file \"%s\".\n", fname);
+        return false;
+    }
+
+    if (!decoder_check_magic(dec))
+    {
+        fprintf(stderr, "ERROR: \"%s\" is not a valid %s file.\n", fname,
+                compression == COMPRESSION_GZIP ? "gzip" : "zstd");
+        mapped_file_close(&dec->file);
+        return false;
+    }
+
+    if (compression == COMPRESSION_GZIP)
+    {
+#ifdef WITH_ZLIB
+        memset(&dec->zlib, 0, sizeof(dec->zlib));
+        // 15 + 16: maximum window, gzip header.
+        if (inflateInit2(&dec->zlib, 15 + 16) == Z_OK)
+            return true;
+        fprintf(stderr, "ERROR: failed to initialize zlib.\n");
+#else
+        fprintf(stderr, "ERROR: gzip support was not compiled in, zlib is required.\n");
+#endif
+    }
+    else
+    {
+#ifdef WITH_ZSTD
+        if ((dec->zstd = ZSTD_createDStream()) && !ZSTD_isError(ZSTD_initDStream(dec->zstd)))
+            return true;
+        fprintf(stderr, "ERROR: failed to initialize zstd.\n");
+        ZSTD_freeDStream(dec->zstd);
+#else
+        fprintf(stderr, "ERROR: zstd support was not compiled in, libzstd is required.\n");
+#endif
+    }
+
+    mapped_file_close(&dec->file);
+    return false;
+}
+
+#ifdef WITH_ZLIB
+static bool decoder_read_gzip(struct decoder *dec, char *out, size_t cap, size_t *written)
+{
+    z_stream *z = &dec->zlib;
+
+    while (*written < cap && !dec->done)
+    {
+        if (z->avail_in == 0)
+        {
+            size_t left = dec->file.size - dec->in_pos;
+            if (left == 0)
+            {
+                fprintf(stderr, "ERROR: \"%s\" is truncated.\n", dec->fname);
+                return false;
+            }
+            z->next_in = (unsigned char *) dec->file.data + dec->in_pos;
+            z->avail_in = left < ZLIB_MAX_STEP ? left : ZLIB_MAX_STEP;
+            dec->in_pos += z->avail_in;
+        }
+
+        size_t out_left = cap - *written;
+        z->next_out = (unsigned char *) out + *written;
+        z->avail_out = out_left < ZLIB_MAX_STEP ? out_left : ZLIB_MAX_STEP;
+        unsigned int avail_out = z->avail_out;
+
+        int ret = inflate(z, Z_NO_FLUSH);
+        *written += avail_out - z->avail_out;
+
+        if (ret == Z_STREAM_END)
+        {
+            // Concatenated gzip members are decompressed as a single file.
+            if (z->avail_in == 0 && dec->in_pos == dec->file.size)
+                dec->done = true;
+            else
+                inflateReset(z);
+        }
+        else if (ret != Z_OK && ret != Z_BUF_ERROR)
+        {
+            fprintf(stderr, "ERROR: failed to decompress \"%s\" (%s).\n", dec->fname,
+                    z->msg ? z->msg : "invalid data");
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+#ifdef WITH_ZSTD
+static bool decoder_read_zstd(struct decoder *dec, char *out, size_t cap, size_t *written)
+{
+    ZSTD_inBuffer in = {dec->file.data, dec->file.size, dec->in_pos};
+
+    while (*written < cap && !dec->done)
+    {
+        ZSTD_outBuffer output = {out, cap, *written};
+        size_t ret = ZSTD_decompressStream(dec->zstd, &output, &in);
+        *written = output.pos;
+
+        if (ZSTD_isError(ret))
+        {
+            fprintf(stderr, "ERROR: failed to decompress \"%s\" (%s).\n", dec->fname,
+                    ZSTD_getErrorName(ret));
+            return false;
+        }
+        if (in.pos == in.size && output.pos < output.size)
+        {
+            // All the input was consumed and flushed, it should end in a complete frame.
+            if (ret != 0)
+            {
+                fprintf(stderr, "ERROR: \"%s\" is truncated.\n", dec->fname);
+                return false;
+            }
+            dec->done = true;
+        }
+    }
+
+    dec->in_pos = in.pos;
+    return true;
+}
+#endif
+
+// Decompress until the output is full or the file ends, adding to *written.
+static bool decoder_read(struct decoder *dec, char *out, size_t cap, size_t *written)
+{
+#ifdef WITH_ZLIB
+    if (dec->compression == COMPRESSION_GZIP)
+        return decoder_read_gzip(dec, out, cap, written);
+#endif
+#ifdef WITH_ZSTD
+    if (dec->compression == COMPRESSION_ZSTD)
+        return decoder_read_zstd(dec, out, cap, written);
+#endif
+    return false;
+}
+
+static void decoder_close(struct decoder *dec)
+{
+#ifdef WITH_ZLIB
+    if (dec->compression == COMPRESSION_GZIP)
+        inflateEnd(&dec->zlib);
+#endif
+#ifdef WITH_ZSTD
+    if (dec->compression == COMPRESSION_ZSTD)
+        ZSTD_freeDStream(dec->zstd);
+#endif
+    mapped_file_close(&dec->file);
+}
+
+// Compressed bytes actually decompressed so far.
+static size_t decoder_consumed(const struct decoder *dec)
+{
+#ifdef WITH_ZLIB
+    if (dec->compression == COMPRESSION_GZIP)
+        return dec->in_pos - dec->zlib.avail_in;
+#endif
+    return dec->in_pos;
+}
+
+// Guess of the decompressed size, to avoid reallocations.
+static size_t decoder_size_hint(const struct decoder *dec)
+{
+    const unsigned char *data = (const unsigned char *) dec->file.data;
+    size_t size = dec->file.size;
+    size_t hint = 0;
+
+    if (dec->compression == COMPRESSION_GZIP && size >= 18)
+    {
+        // The gzip trailer has the decompressed size, modulo 2^32.
+        hint = (size_t) data[size - 4] | (size_t) data[size - 3] << 8
+            | (size_t) data[size - 2] << 16 | (size_t) data[size - 1] << 24;
+    }
+#ifdef WITH_ZSTD
+    if (dec->compression == COMPRESSION_ZSTD)
+    {
+        unsigned long long content_size = ZSTD_getFrameContentSize(data, size);
+        if (content_size != ZSTD_CONTENTSIZE_UNKNOWN && content_size != ZSTD_CONTENTSIZE_ERROR)
+            hint = content_size;
+    }
+#endif
+
+    if (hint < size)
+        hint = 4 * size;
+    // One extra byte, so the end of the file is found without growing the buffer.
+    return hint + 1;
+}
+
+bool decompress_file(const char *fname, enum compression compression, char **data, size_t *size,
+        size_t *compressed_size)
+{
+    struct decoder dec;
+    if (!decoder_open(&dec, fname, compression))
+        return false;
+
+    size_t cap = decoder_size_hint(&dec);
+    size_t written = 0;
+    char *buffer = NULL;
+
+    while (true)
+    {
+        char *new_buffer;
+        if (!(new_buffer = realloc(buffer, cap)))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+        buffer = new_buffer;
+
+        if (!decoder_read(&dec, buffer, cap, &written))
+        {
+            free(buffer);
+            decoder_close(&dec);
+            return false;
+        }
+        if (dec.done)
+            break;
+        cap *= 2;
+    }
+
+    *data = buffer;
+    *size = written;
+    *compressed_size = dec.file.size;
+    decoder_close(&dec);
+    return true;
+}
+
+struct decompress_block
+{
+    char *data;
+    size_t size;
+};
+
+struct decompress_stream
+{
+    struct decoder decoder;
+    size_t compressed_size;
+    pthread_t thread;
+
+    // Blocks published by the decompression thread, guarded by the mutex.
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct decompress_block *blocks;
+    size_t blocks_count;
+    size_t blocks_capacity;
+    size_t blocks_taken;
+    // Published blocks that were not released yet, the thread waits while there are max_blocks.
+    size_t blocks_kept;
+    size_t max_blocks;
+    // Compressed bytes read to make the published blocks.
+    size_t consumed;
+    bool finished;
+    bool failed;
+    // Set when the stream is closed, so that the thread stops before the next block.
+    bool cancelled;
+};
+
+static void stream_publish(struct decompress_stream *stream, char *data, size_t size, bool finished,
+        bool failed)
+{
+    pthread_mutex_lock(&stream->mutex);
+
+    if (data)
+    {
+        while (stream->blocks_kept >= stream->max_blocks && !stream->cancelled)
+            pthread_cond_wait(&stream->cond, &stream->mutex);
+
+        if (stream->blocks_count == stream->blocks_capacity)
+        {
+            stream->blocks_capacity = stream->blocks_capacity ? 2 * stream->blocks_capacity : 16;
+            stream->blocks = realloc(stream->blocks, stream->blocks_capacity * sizeof(*stream->blocks));
+            if (!stream->blocks)
+            {
+                fprintf(stderr, "ERROR: Memory allocation failure.\n");
+                exit(1);
+            }
+        }
+        stream->blocks[stream->blocks_count++] = (struct decompress_block){data, size};
+        stream->blocks_kept++;
+    }
+    stream->consumed = decoder_consumed(&stream->decoder);
+    stream->finished = finished;
+    stream->failed = failed;
+
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+static char *block_alloc(size_t size)
+{
+    char *data;
+    if (!(data = malloc(size)))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+    return data;
+}
+
+static bool stream_cancelled(struct decompress_stream *stream)
+{
+    pthread_mutex_lock(&stream->mutex);
+    bool cancelled = stream->cancelled;
+    pthread_mutex_unlock(&stream->mutex);
+    return cancelled;
+}
+
+static void *stream_thread_main(void *arg)
+{
+    struct decompress_stream *stream = arg;
+    struct decoder *dec = &stream->decoder;
+
+    size_t cap = DECOMPRESS_BLOCK_SIZE;
+    char *block = block_alloc(cap);
+    size_t size = 0;
+
+    while (true)
+    {
+        if (stream_cancelled(stream) || !decoder_read(dec, block, cap, &size))
+        {
+            free(block);
+            stream_publish(stream, NULL, 0, true, true);
+            return NULL;
+        }
+
+        if (dec->done)
+        {
+            if (size > 0)
+                stream_publish(stream, block, size, true, false);
+            else
+            {
+                free(block);
+                stream_publish(stream, NULL, 0, true, false);
+            }
+            return NULL;
+        }
+
+        // The block is full, split it after its last line.
+        const char *eol = block + size;
+        while (eol > block && eol[-1] != '\n')
+            eol--;
+        if (eol == block)
+        {
+            cap *= 2;
+            if (!(block = realloc(block, cap)))
+            {
+                fprintf(stderr, "ERROR: Memory allocation failure.\n");
+                exit(1);
+            }
+            continue;
+        }
+
+        size_t block_size = eol - block;
+        size_t tail = size - block_size;
+
+        cap = tail < DECOMPRESS_BLOCK_SIZE / 2 ? DECOMPRESS_BLOCK_SIZE : 2 * tail;
+        char *next = block_alloc(cap);
+        memcpy(next, eol, tail);
+
+        stream_publish(stream, block, block_size, false, false);
+
+        block = next;
+        size = tail;
+    }
+}
+
+struct decompress_stream *decompress_stream_open(const char *fname, enum compression compression,
+        size_t max_blocks)
+{
+    struct decompress_stream *stream;
+    if (!(stream = calloc(1, sizeof(*stream))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+
+    if (!decoder_open(&stream->decoder, fname, compression))
+    {
+        free(stream);
+        return NULL;
+    }
+    stream->compressed_size = stream->decoder.file.size;
+    stream->max_blocks = max_blocks > 0 ? max_blocks : 1;
+
+    pthread_mutex_init(&stream->mutex, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+
+    if (pthread_create(&stream->thread, NULL, stream_thread_main, stream) != 0)
+    {
+        fprintf(stderr, "ERROR: Failed to create thread.\n");
+        exit(1);
+    }
+    return stream;
+}
+
+bool decompress_stream_next(struct decompress_stream *stream, const char **data, size_t *size,
+        size_t *index)
+{
+    pthread_mutex_lock(&stream->mutex);
+
+    while (stream->blocks_taken == stream->blocks_count && !stream->finished)
+        pthread_cond_wait(&stream->cond, &stream->mutex);
+
+    bool available = stream->blocks_taken < stream->blocks_count;
+    if (available)
+    {
+        *data = stream->blocks[stream->blocks_taken].data;
+        *size = stream->blocks[stream->blocks_taken].size;
+        *index = stream->blocks_taken;
+        stream->blocks_taken++;
+    }
+
+    pthread_mutex_unlock(&stream->mutex);
+    return available;
+}
+
+void decompress_stream_release(struct decompress_stream *stream, size_t index)
+{
+    pthread_mutex_lock(&stream->mutex);
+
+    free(stream->blocks[index].data);
+    stream->blocks[index].data = NULL;
+    stream->blocks_kept--;
+
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+}
+
+bool decompress_stream_ok(const struct decompress_stream *stream)
+{
+    return stream->finished && !stream->failed;
+}
+
+size_t decompress_stream_compressed_size(const struct decompress_stream *stream)
+{
+    return stream->compressed_size;
+}
+
+size_t decompress_stream_consumed(struct decompress_stream *stream)
+{
+    pthread_mutex_lock(&stream->mutex);
+    size_t consumed = stream->consumed;
+    pthread_mutex_unlock(&stream->mutex);
+    return consumed;
+}
+
+void decompress_stream_close(struct decompress_stream *stream)
+{
+    pthread_mutex_lock(&stream->mutex);
+    stream->cancelled = true;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+
+    pthread_join(stream->thread, NULL);
+
+    for (size_t i = 0; i < stream->blocks_count; ++i)
+        free(stream->blocks[i].data);
+    free(stream->blocks);
+
+    pthread_mutex_destroy(&stream->mutex);
+    pthread_cond_destroy(&stream->cond);
+    decoder_close(&stream->decoder);
+    free(stream);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum compression
+{
+    COMPRESSION_NONE,
+    COMPRESSION_GZIP,
+    COMPRESSION_ZSTD,
+};
+
+// Compression of the file according to its extension (".gz" or ".zst").
+enum compression compression_from_filename(const char *fname);
+
+// Length of the file name without the compression extension.
+size_t compression_strip_extension(const char *fname);
+
+// Decompress the whole file into a single malloc'ed buffer.
+bool decompress_file(const char *fname, enum compression compression, char **data, size_t *size,
+        size_t *compressed_size);
+
+// Text file decompressed by a background thread, so it can be parsed while it is being read.
+struct decompress_stream;
+
+// The decompression waits while max_blocks blocks are published and not released.
+struct decompress_stream *decompress_stream_open(const char *fname, enum compression compression,
+        size_t max_blocks);
+
+// Wait for the next block of the file and its index, blocks always end at a newline (or at the end
+// of the file). Can be called from several threads, the blocks stay valid until they are released
+// or the stream is closed. Returns false when there are no more blocks.
+bool decompress_stream_next(struct decompress_stream *stream, const char **data, size_t *size,
+        size_t *index);
+
+// Free a block that is not used anymore, letting the decompression go on.
+void decompress_stream_release(struct decompress_stream *stream, size_t index);
+
+// Whether the file was fully decompressed without errors, only valid after the last block.
+bool decompress_stream_ok(const struct decompress_stream *stream);
+
+size_t decompress_stream_compressed_size(const struct decompress_stream *stream);
+
+// Compressed bytes read so far.
+size_t decompress_stream_consumed(struct decompress_stream *stream);
+
+// Stop the decompression if it didn't finish, and free the stream.
+void decompress_stream_close(struct decompress_stream *stream);
@@ -0,0 +1,226 @@
+#include "json.h"
+
+#include "scan.h"
+
+#include <string.h>
+
+// Nesting limit, so malformed input can't overflow the stack.
+#define JSON_MAX_DEPTH 64
+
+struct json_parser
+{
+    const char *p;
+    const char *end;
+    struct arena *arena;
+};
+
+static void json_skip_spaces(struct json_parser *parser)
+{
+    while (parser->p < parser->end &&
+            (*parser->p == ' ' || *parser->p == '\t' || *parser->p == '\n' || *parser->p == '\r'))
+    {
+        parser->p++;
+    }
+}
+
+static bool json_expect(struct json_parser *parser, char c)
+{
+    json_skip_spaces(parser);
+    if (parser->p < parser->end && *parser->p == c)
+    {
+        parser->p++;
+        return true;
+    }
+    return false;
+}
+
+static bool json_literal(struct json_parser *parser, const char *literal)
+{
+    size_t len = strlen(literal);
+    if ((size_t) (parser->end - parser->p) < len || memcmp(parser->p, literal, len) != 0)
+        return false;
+    parser->p += len;
+    return true;
+}
+
+static bool json_parse_string(struct json_parser *parser, const char **str, size_t *len)
+{
+    if (!json_expect(parser, '"'))
+        return false;
+
+    const char *start = parser->p;
+    while (parser->p < parser->end && *parser->p != '"')
+    {
+        if (*parser->p == '\\')
+            parser->p++;
+        parser->p++;
+    }
+    if (parser->p >= parser->end)
+        return false;
+
+    *str = start;
+    *len = parser->p - start;
+    parser->p++;
+    return true;
+}
+
+static bool json_parse_number(struct json_parser *parser, double *number)
+{
+    const char *start = parser->p;
+    bool integer = true;
+
+    if (parser->p < parser->end && *parser->p == '-')
+        parser->p++;
+    while (parser->p < parser->end)
+    {
+        char c = *parser->p;
+        if (c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')
+            integer = false;
+        else if (c < '0' || c > '9')
+            break;
+        parser->p++;
+    }
+    if (parser->p == start || (parser->p == start + 1 && *start == '-'))
+        return false;
+
+    if (integer)
+    {
+        // Exact, offsets and counts can exceed the precision of a float.
+        double val = 0;
+        for (const char *c = *start == '-' ? start + 1 : start; c < parser->p; ++c)
+            val = val * 10 + (*c - '0');
+        *number = *start == '-' ? -val : val;
+    }
+    else
+        *number = scan_parse_float(start, parser->p);
+    return true;
+}
+
+static struct json_value *json_parse_value(struct json_parser *parser, int depth)
+{
+    if (depth > JSON_MAX_DEPTH)
+        return NULL;
+
+    json_skip_spaces(parser);
+    if (parser->p >= parser->end)
+        return NULL;
+
+    struct json_value *value = arena_alloc(parser->arena, sizeof(*value));
+    memset(value, 0, sizeof(*value));
+
+    char c = *parser->p;
+    if (c == '{' || c == '[')
+    {
+        bool object = c == '{';
+        char close = object ? '}' : ']';
+        value->type = object ? JSON_OBJECT : JSON_ARRAY;
+        parser->p++;
+
+        if (json_expect(parser, close))
+            return value;
+
+        struct json_value **tail = &value->first;
+        do
+        {
+            const char *key = NULL;
+            size_t key_len = 0;
+            if (object && (!json_parse_string(parser, &key, &key_len) || !json_expect(parser, ':')))
+                return NULL;
+
+            struct json_value *item;
+            if (!(item = json_parse_value(parser, depth + 1)))
+                return NULL;
+            item->key = key;
+            item->key_len = key_len;
+
+            *tail = item;
+            tail = &item->next;
+            value->count++;
+        }
+        while (json_expect(parser, ','));
+
+        if (!json_expect(parser, close))
+            return NULL;
+    }
+    else if (c == '"')
+    {
+        value->type = JSON_STRING;
+        if (!json_parse_string(parser, &value->string, &value->string_len))
+            return NULL;
+    }
+    else if (c == 't' || c == 'f')
+    {
+        value->type = JSON_BOOL;
+        value->boolean = c == 't';
+        if (!json_literal(parser, value->boolean ? "true" : "false"))
+            return NULL;
+    }
+    else if (c == 'n')
+    {
+        value->type = JSON_NULL;
+        if (!json_literal(parser, "null"))
+            return NULL;
+    }
+    else
+    {
+        value->type = JSON_NUMBER;
+        if (!json_parse_number(parser, &value->number))
+            return NULL;
+    }
+    return value;
+}
+
+struct json_value *json_parse(const char *text, size_t size, struct arena *arena)
+{
+    struct json_parser parser;
+    parser.p = text;
+    parser.end = text + size;
+    parser.arena = arena;
+
+    struct json_value *root = json_parse_value(&parser, 0);
+
+    // Only spaces (or the padding of binary formats) can follow.
+    json_skip_spaces(&parser);
+    while (parser.p < parser.end && *parser.p == '\0')
+        parser.p++;
+    if (parser.p != parser.end)
+        return NULL;
+    return root;
+}
+
+const struct json_value *json_get(const struct json_value *object, const char *key)
+{
+    if (!object || object->type != JSON_OBJECT)
+        return NULL;
+
+    for (const struct json_value *member = object->first; member; member = member->next)
+    {
+        if (scan_token_equals(member->key, member->key_len, key))
+            return member;
+    }
+    return NULL;
+}
+
+const struct json_value *json_at(const struct json_value *array, size_t i)
+{
+    if (!array || array->type != JSON_ARRAY || i >= array->count)
+        return NULL;
+
+    const struct json_value *item = array->first;
+    while (i--)
+        item = item->next;
+    return item;
+}
+
+double json_number(const struct json_value *value, double default_value)
+{
+    if (!value || value->type != JSON_NUMBER)
+        return default_value;
+    return value->number;
+}
+
+bool json_string_equals(const struct json_value *value, const char *str)
+{
+    return value && value->type == JSON_STRING &&
+            scan_token_equals(value->string, value->string_len, str);
+}
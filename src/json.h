@@ -0,0 +1,53 @@
+#pragma once
+
+#include "arena.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Minimal JSON reader, enough for the metadata of binary formats (e.g. the JSON chunk of a GLB).
+// Strings are kept as they appear in the text, without decoding escape sequences.
+
+enum json_type
+{
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+};
+
+struct json_value
+{
+    enum json_type type;
+    bool boolean;
+    double number;
+    // String contents, not NUL-terminated.
+    const char *string;
+    size_t string_len;
+
+    // Key of the value when it is an object member.
+    const char *key;
+    size_t key_len;
+
+    // Items of an array or members of an object, as a linked list.
+    struct json_value *first;
+    struct json_value *next;
+    size_t count;
+};
+
+// Parse the JSON text, the values are allocated in the arena and point into the text.
+// Returns NULL if the text is not valid JSON.
+struct json_value *json_parse(const char *text, size_t size, struct arena *arena);
+
+// Member of an object with the given key, NULL if missing or the value is not an object.
+const struct json_value *json_get(const struct json_value *object, const char *key);
+
+// Item of an array, NULL if out of range or the value is not an array.
+const struct json_value *json_at(const struct json_value *array, size_t i);
+
+// Number of the value, or the default if it is missing or not a number.
+double json_number(const struct json_value *value, double default_value);
+
+bool json_string_equals(const struct json_value *value, const char *str);
@@ -0,0 +1,414 @@
+#include "loader.h"
+
+#include "decompress.h"
+#include "timing.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define CACHE_DIR_NAME "3d-ascii-viewer"
+#define BINARY_EXTENSION "3dav"
+
+#define SOURCE_FLAG_COLOR 1
+#define SOURCE_FLAG_WELD 2
+// Index of the permutation of the axes, 3 bits that are 0 for the default one
+#define SOURCE_FLAG_AXES_SHIFT 2
+#define SOURCE_FLAG_FLIP_FACES 32
+#define SOURCE_FLAG_INVERT_X 64
+#define SOURCE_FLAG_INVERT_Y 128
+#define SOURCE_FLAG_INVERT_Z 256
+
+void init_file_extension(char dst[5], const char *filename)
+{
+    for (int i = 0; i < 5; ++i)
+        dst[i] = '\0';
+
+    // The format of compressed files is given by the inner extension, e.g. "model.obj.gz".
+    const char *end = filename + compression_strip_extension(filename);
+
+    const char *ext = end;
+    while (ext > filename && ext[-1] != '.')
+        ext--;
+    if (ext <= filename + 1)
+        return;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        if (ext + i == end)
+            break;
+        dst[i] = tolower(ext[i]);
+    }
+}
+
+// Create the directory, and its parents if required.
+static bool make_dirs(char *path)
+{
+    for (char *p = path + 1; *p; ++p)
+    {
+        if (*p != '/')
+            continue;
+
+        *p = '\0';
+        bool ok = mkdir(path, 0755) == 0 || errno == EEXIST;
+        *p = '/';
+        if (!ok)
+            return false;
+    }
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+static unsigned long long hash_string(const char *str)
+{
+    // FNV-1a
+    unsigned long long hash = 14695981039346656037ull;
+    for (; *str; ++str)
+    {
+        hash ^= (unsigned char) *str;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Name of the cache file for the source, NULL if there is no cache directory.
+static char *cache_file_name(const struct model_source *source)
+{
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *base_suffix = "";
+
+    if (!base || base[0] != '/')
+    {
+        base = getenv("HOME");
+        base_suffix = "/.cache";
+        if (!base || base[0] != '/')
+            return NULL;
+    }
+
+    size_t size = strlen(base) + strlen(base_suffix) + strlen(CACHE_DIR_NAME) + 64;
+    char *fname;
+    if (!(fname = malloc(size)))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+
+    snprintf(fname, size, "%s%s/%s", base, base_suffix, CACHE_DIR_NAME);
+    if (!make_dirs(fname))
+    {
+        free(fname);
+        return NULL;
+    }
+
+    size_t len = strlen(fname);
+    snprintf(fname + len, size - len, "/%016llx-%u.%s", hash_string(source->path), source->flags,
+            BINARY_EXTENSION);
+    return fname;
+}
+
+// Flags of the source for the orientation applied to the model, 0 for the default one.
+static unsigned int orientation_flags(const struct model_orientation *orientation)
+{
+    if (!orientation)
+        return 0;
+
+    const int *axes = orientation->axes;
+    unsigned int permutation = 2 * axes[0] + (axes[1] > axes[2]);
+
+    // Both flips invert the faces
+    return (permutation << SOURCE_FLAG_AXES_SHIFT)
+        | (orientation->axes_flip_faces != orientation->flip_faces ? SOURCE_FLAG_FLIP_FACES : 0)
+        | (orientation->invert_x ? SOURCE_FLAG_INVERT_X : 0)
+        | (orientation->invert_y ? SOURCE_FLAG_INVERT_Y : 0)
+        | (orientation->invert_z ? SOURCE_FLAG_INVERT_Z : 0);
+}
+
+static struct model *load_source_model(const char *fname, const char *file_extension,
+        const struct load_options *options)
+{
+    struct model *model;
+
+    if (file_extension[0] == '\0')
+    {
+        fprintf(stderr, "ERROR: Input file has no extension.\n");
+        return NULL;
+    }
+    else if (strcmp(file_extension, "obj") == 0)
+    {
+        if (!(model = model_load_from_obj(fname, options->color_support, options->progress)))
+            return NULL;
+        model_invert_z(model); // Required by the OBJ format.
+    }
+    else if (strcmp(file_extension, "stl") == 0)
+    {
+        if (!(model = model_load_from_stl(fname, options->progress)))
+            return NULL;
+    }
+    else if (strcmp(file_extension, "ply") == 0)
+    {
+        if (!(model = model_load_from_ply(fname)))
+            return NULL;
+        model_invert_z(model); // Same coordinate system as the OBJ format.
+    }
+    else if (strcmp(file_extension, "glb") == 0)
+    {
+        if (!(model = model_load_from_glb(fname, options->color_support)))
+            return NULL;
+        model_invert_z(model); // Same coordinate system as the OBJ format.
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Input file has unsupported extension.\n");
+        return NULL;
+    }
+
+    if (model->vertex_count == 0)
+    {
+        fprintf(stderr, "ERROR: Could not read model vertexes.\n");
+        model_free(model);
+        return NULL;
+    }
+    if (model->faces_count == 0)
+    {
+        fprintf(stderr, "ERROR: Could not read model faces.\n");
+        model_free(model);
+        return NULL;
+    }
+    return model;
+}
+
+struct model *load_model(const char *fname, const struct load_options *options)
+{
+    char file_extension[5];
+    init_file_extension(file_extension, fname);
+
+    // Binary models are already preprocessed
+    if (strcmp(file_extension, BINARY_EXTENSION) == 0)
+    {
+        if (compression_from_filename(fname) != COMPRESSION_NONE)
+        {
+            fprintf(stderr, "ERROR: Binary models can't be compressed, they are mapped in memory.\n");
+            return NULL;
+        }
+        struct model *model = model_load_from_binary(fname, NULL);
+        if (model && options->orientation)
+            model_orient(model, options->orientation);
+        return model;
+    }
+
+    if (strcmp(file_extension, "stl") == 0 && options->color_support)
+    {
+        fprintf(stderr, "WARN: Colors are not supported in STL format.\n");
+    }
+    if (strcmp(file_extension, "ply") == 0 && options->color_support)
+    {
+        fprintf(stderr, "WARN: Colors are not supported in PLY format.\n");
+    }
+
+    bool weld = (options->weld || strcmp(file_extension, "stl") == 0) && !options->no_weld;
+
+    // Identify the source file for the cache
+    struct model_source source;
+    char *source_path = NULL;
+    char *cache_fname = NULL;
+    struct stat st;
+
+    if (options->use_cache && (source_path = realpath(fname, NULL)) && stat(source_path, &st) == 0)
+    {
+        source.path = source_path;
+        source.size = st.st_size;
+        source.mtime_sec = st.st_mtim.tv_sec;
+        source.mtime_nsec = st.st_mtim.tv_nsec;
+        source.flags = (options->color_support ? SOURCE_FLAG_COLOR : 0) | (weld ? SOURCE_FLAG_WELD : 0)
+                | orientation_flags(options->orientation);
+
+        cache_fname = cache_file_name(&source);
+    }
+
+    struct model *model = NULL;
+    if (cache_fname && (model = model_load_from_binary(cache_fname, &source)))
+    {
+        model->load_stats.from_cache = true;
+    }
+    else if ((model = load_source_model(fname, file_extension, options)))
+    {
+        if (weld)
+            model_weld_vertexes(model);
+
+        model_normalize(model);
+
+        if (options->orientation)
+            model_orient(model, options->orientation);
+
+        if (cache_fname && !model_save_binary(model, cache_fname, &source))
+            fprintf(stderr, "WARN: failed to write cache file \"%s\".\n", cache_fname);
+    }
+
+    free(source_path);
+    free(cache_fname);
+    return model;
+}
+
+struct load_job
+{
+    char *fname;
+    struct load_options options;
+    struct model_progress progress;
+    pthread_t thread;
+    unsigned long long start_useconds;
+
+    // Result of the loading thread, guarded by the progress mutex.
+    bool finished;
+    struct model *model;
+
+    // Transformation from the file coordinates to the preview ones.
+    bool invert_z;
+    bool bounds_known;
+    vec3 center;
+    float scale;
+};
+
+static void *load_job_main(void *arg)
+{
+    struct load_job *job = arg;
+    struct model *model = load_model(job->fname, &job->options);
+
+    pthread_mutex_lock(&job->progress.mutex);
+    job->model = model;
+    job->finished = true;
+    pthread_mutex_unlock(&job->progress.mutex);
+    return NULL;
+}
+
+struct load_job *load_model_start(const char *fname, const struct load_options *options)
+{
+    struct load_job *job;
+    if (!(job = malloc(sizeof(*job))) || !(job->fname = strdup(fname)))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+
+    char file_extension[5];
+    init_file_extension(file_extension, fname);
+
+    job->options = *options;
+    job->options.progress = &job->progress;
+    model_progress_init(&job->progress);
+    job->start_useconds = get_current_useconds();
+    job->finished = false;
+    job->model = NULL;
+    job->invert_z = strcmp(file_extension, "obj") == 0 || strcmp(file_extension, "ply") == 0 ||
+            strcmp(file_extension, "glb") == 0;
+    job->bounds_known = false;
+
+    if (pthread_create(&job->thread, NULL, load_job_main, job) != 0)
+    {
+        fprintf(stderr, "ERROR: Failed to create thread.\n");
+        exit(1);
+    }
+    return job;
+}
+
+bool load_job_finished(struct load_job *job)
+{
+    pthread_mutex_lock(&job->progress.mutex);
+    bool finished = job->finished;
+    pthread_mutex_unlock(&job->progress.mutex);
+    return finished;
+}
+
+// Move the vertexes from the file coordinates to the preview ones.
+static void load_job_transform(const struct load_job *job, struct model *part)
+{
+    for (unsigned int i = 0; i < part->vertex_count; ++i)
+    {
+        part->vertexes[i].x = (part->vertexes[i].x - job->center.x) * job->scale;
+        part->vertexes[i].y = (part->vertexes[i].y - job->center.y) * job->scale;
+        part->vertexes[i].z = (part->vertexes[i].z - job->center.z) * job->scale;
+    }
+
+    if (job->invert_z)
+        model_invert_z(part);
+    if (job->options.orientation)
+        model_orient(part, job->options.orientation);
+}
+
+struct model *load_job_bounds_model(struct load_job *job)
+{
+    struct model *samples = model_progress_samples(&job->progress);
+    if (!samples)
+        return NULL;
+
+    if (!job->bounds_known)
+    {
+        // Same normalization as model_normalize, but only with the samples
+        job->center = get_bounding_box_center(samples->vertexes, samples->vertex_count);
+        float max_mag = get_max_dist(samples->vertexes, samples->vertex_count, job->center);
+        job->scale = (max_mag == 0) ? 1.0 : 1.0 / max_mag;
+        job->bounds_known = true;
+    }
+
+    load_job_transform(job, samples);
+    return samples;
+}
+
+bool load_job_update_preview(struct load_job *job, struct model *preview)
+{
+    if (!job->bounds_known)
+        return false;
+
+    unsigned int first_vertex = preview->vertex_count;
+    unsigned int first_face = preview->faces_count;
+
+    if (!model_progress_copy(&job->progress, preview))
+        return false;
+
+    struct model tail = model_tail(preview, first_vertex, first_face);
+    load_job_transform(job, &tail);
+    return true;
+}
+
+void load_job_status(struct load_job *job, float *fraction, float *megabytes_per_second)
+{
+    pthread_mutex_lock(&job->progress.mutex);
+    unsigned long long done = job->progress.bytes_done;
+    unsigned long long total = job->progress.bytes_total;
+    pthread_mutex_unlock(&job->progress.mutex);
+
+    unsigned long long elapsed = get_current_useconds() - job->start_useconds;
+
+    *fraction = (total > 0) ? (float) done / total : 0;
+    *megabytes_per_second = (elapsed > 0) ? done / (float) elapsed : 0;
+}
+
+static void load_job_free(struct load_job *job)
+{
+    model_progress_destroy(&job->progress);
+    free(job->fname);
+    free(job);
+}
+
+struct model *load_job_finish(struct load_job *job)
+{
+    pthread_join(job->thread, NULL);
+    struct model *model = job->model;
+    load_job_free(job);
+    return model;
+}
+
+void load_job_cancel(struct load_job *job)
+{
+    pthread_mutex_lock(&job->progress.mutex);
+    job->progress.cancelled = true;
+    pthread_mutex_unlock(&job->progress.mutex);
+
+    pthread_join(job->thread, NULL);
+    if (job->model)
+        model_free(job->model);
+    load_job_free(job);
+}
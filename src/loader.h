@@ -0,0 +1,48 @@
+#pragma once
+
+#include "model.h"
+
+#include <stdbool.h>
+
+struct load_options
+{
+    bool color_support;
+    // Merge duplicated vertexes, by default only for STL files.
+    bool weld, no_weld;
+    // Keep the preprocessed model in the cache directory, to load it faster the next time.
+    bool use_cache;
+    // If not NULL, the parts of the model are published as they are loaded.
+    struct model_progress *progress;
+    // If not NULL, applied to the model before it is cached, so that the cached model is final. It
+    // must outlive the loading.
+    const struct model_orientation *orientation;
+};
+
+// Load a model from any of the supported formats, normalized to fit in the [-1, 1]^3 cube.
+struct model *load_model(const char *fname, const struct load_options *options);
+
+// Model loaded by a background thread, with a preview of the part that is already loaded.
+struct load_job;
+
+struct load_job *load_model_start(const char *fname, const struct load_options *options);
+
+bool load_job_finished(struct load_job *job);
+
+// Model made from the positions sampled over the file, normalized as the preview, or NULL if the
+// bounds are not known yet.
+struct model *load_job_bounds_model(struct load_job *job);
+
+// Append the newly loaded vertexes and faces to the preview, normalized with the estimated bounds.
+// Returns false if there was nothing new.
+bool load_job_update_preview(struct load_job *job, struct model *preview);
+
+// Fraction of the file that was loaded and the throughput so far, in MB/s.
+void load_job_status(struct load_job *job, float *fraction, float *megabytes_per_second);
+
+// Wait for the model and free the job, returns NULL if it failed.
+struct model *load_job_finish(struct load_job *job);
+
+// Stop the loading as soon as possible and free the job.
+void load_job_cancel(struct load_job *job);
+
+void init_file_extension(char dst[5], const char *filename);
@@ -0,0 +1,91 @@
+#include "lod.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Levels with less faces than this are not made.
+#define LOD_MIN_FACES 64
+// Finest grid, cells per side of the model bounds.
+#define LOD_MAX_GRID_SIZE (1 << 16)
+
+struct lod_chain *lod_chain_init(struct model *model)
+{
+    struct lod_chain *chain;
+    if (!(chain = malloc(sizeof(*chain))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+    chain->levels[0] = model;
+    chain->errors[0] = 0;
+    chain->levels_count = 1;
+
+    if (model->vertex_count == 0)
+        return chain;
+
+    struct vertex_bounds bounds = model_bounds(model);
+    vec3 min = bounds.min;
+    vec3 max = bounds.max;
+    float extent = fmaxf(max.x - min.x, fmaxf(max.y - min.y, max.z - min.z));
+
+    // Surfaces have about grid_size^2 occupied cells, start with one vertex per cell
+    unsigned int grid_size = 2;
+    while (grid_size * grid_size < model->vertex_count && grid_size < LOD_MAX_GRID_SIZE)
+        grid_size *= 2;
+
+    // Each grid is simplified from the previous one, that is already smaller. The cells are
+    // nested, so the vertexes stay in the cell of the original ones and move at most its diagonal.
+    const struct model *input = model;
+    struct model *discarded = NULL;
+
+    for (; grid_size >= 2 && chain->levels_count < LOD_MAX_LEVELS; grid_size /= 2)
+    {
+        const struct model *prev = chain->levels[chain->levels_count - 1];
+        float cell_size = extent / grid_size;
+
+        struct model *level = model_simplify(input, min, cell_size);
+        if (discarded)
+        {
+            model_free(discarded);
+            discarded = NULL;
+        }
+
+        if (level->faces_count < LOD_MIN_FACES)
+        {
+            model_free(level);
+            break;
+        }
+        input = level;
+
+        // Not worth it, unless it halves the faces
+        if (2 * level->faces_count > prev->faces_count)
+        {
+            discarded = level;
+            continue;
+        }
+
+        chain->levels[chain->levels_count] = level;
+        chain->errors[chain->levels_count] = sqrtf(3) * cell_size;
+        chain->levels_count++;
+    }
+
+    if (discarded)
+        model_free(discarded);
+    return chain;
+}
+
+void lod_chain_free(struct lod_chain *chain)
+{
+    for (int i = 1; i < chain->levels_count; ++i)
+        model_free(chain->levels[i]);
+    free(chain);
+}
+
+const struct model *lod_chain_select(const struct lod_chain *chain, float max_error)
+{
+    int level = 0;
+    while (level + 1 < chain->levels_count && chain->errors[level + 1] < max_error)
+        level++;
+    return chain->levels[level];
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "model.h"
+
+#define LOD_MAX_LEVELS 12
+
+// Simplified versions of a model, from the most to the least detailed.
+struct lod_chain
+{
+    int levels_count;
+    // The first level is the model itself, the others are owned by the chain.
+    struct model *levels[LOD_MAX_LEVELS];
+    // Upper bound of the distance from each level to the model, in model units.
+    float errors[LOD_MAX_LEVELS];
+};
+
+// Simplify the model with grids of decreasing resolution, keeping the levels that halve the faces.
+struct lod_chain *lod_chain_init(struct model *model);
+
+void lod_chain_free(struct lod_chain *chain);
+
+// Least detailed level with an error below max_error.
+const struct model *lod_chain_select(const struct lod_chain *chain, float max_error);
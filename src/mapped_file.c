@@ -0,0 +1,48 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool mapped_file_open(struct mapped_file *file, const char *fname, bool copy_on_write)
+{
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return false;
+    }
+
+    file->size = st.st_size;
+    file->data = NULL;
+
+    // Empty files can't be mapped, but they are still valid (empty) input.
+    if (file->size > 0)
+    {
+        int prot = copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ;
+        void *data = mmap(NULL, file->size, prot, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        madvise(data, file->size, copy_on_write ? MADV_WILLNEED : MADV_SEQUENTIAL);
+        file->data = data;
+    }
+
+    close(fd);
+    return true;
+}
+
+void mapped_file_close(struct mapped_file *file)
+{
+    if (file->data)
+        munmap((void *) file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
+}
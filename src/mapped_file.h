@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Read-only view of a whole file, mapped into memory.
+struct mapped_file
+{
+    const char *data;
+    size_t size;
+};
+
+// Map the file into memory, returns false if it can't be opened or mapped.
+// With copy_on_write the pages can be modified, without affecting the file, and stay shared
+// with other processes until then.
+bool mapped_file_open(struct mapped_file *file, const char *fname, bool copy_on_write);
+
+void mapped_file_close(struct mapped_file *file);
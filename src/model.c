@@ -1,15 +1,28 @@
 #include "model.h"
 
+#include "arena.h"
+#include "decompress.h"
+#include "json.h"
+#include "mapped_file.h"
+#include "scan.h"
+#include "threads.h"
+#include "timing.h"
 #include "triangularization.h"
 
 #include <assert.h>
 #include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
 
-static struct model *model_init(void)
+#define MATERIAL_NAMES_BLOCK_SIZE 4096
+
+struct model *model_init(void)
 {
     struct model *model = malloc(sizeof(*model));
 
@@ -29,6 +42,15 @@ static struct model *model_init(void)
     }
     model->vertex_count = 0;
 
+    memset(&model->soa, 0, sizeof(model->soa));
+    model->normals_count = 0;
+    model->normals = NULL;
+    model->clusters_count = 0;
+    model->clusters = NULL;
+    model->cluster_nodes_count = 0;
+    model->cluster_nodes = NULL;
+    model->static_chars = NULL;
+
     model->materials_capacity = 1;
     if (!(model->materials = malloc(model->materials_capacity * sizeof(*model->materials))))
     {
@@ -37,14 +59,29 @@ static struct model *model_init(void)
     }
     model->materials_count = 0;
 
+    arena_init(&model->material_names, MATERIAL_NAMES_BLOCK_SIZE);
+    model->material_table_size = 0;
+    model->material_table = NULL;
+
+    model->load_stats = (struct model_load_stats){0};
+    model->load_stats.allocations = 4;
+
+    model->storage.data = NULL;
+    model->storage.size = 0;
+
     return model;
 }
 
-static void model_add_vertex(struct model *model, vec3 vec)
+// Make sure the model has capacity for the given number of additional vertexes and faces.
+// If amortized, the capacity at least doubles, for models that are reserved in several parts.
+static void model_reserve(struct model *model, unsigned int vertexes, unsigned int faces, bool amortized)
 {
-    if (model->vertex_count == model->vertex_capacity)
+    if (model->vertex_count + vertexes > model->vertex_capacity)
     {
-        model->vertex_capacity *= 2;
+        model->load_stats.allocations++;
+        model->vertex_capacity = model->vertex_count + vertexes;
+        if (amortized && model->vertex_capacity < 2 * model->vertex_count)
+            model->vertex_capacity = 2 * model->vertex_count;
         if (!(model->vertexes = realloc(model->vertexes, model->vertex_capacity * sizeof(*model->vertexes))))
         {
             fprintf(stderr, "ERROR: Memory allocation failure.\n");
@@ -52,8 +89,18 @@ static void model_add_vertex(struct model *model, vec3 vec)
         }
     }
 
-    model->vertexes[model->vertex_count] = vec;
-    model->vertex_count++;
+    if (model->faces_count + faces > model->faces_capacity)
+    {
+        model->load_stats.allocations++;
+        model->faces_capacity = model->faces_count + faces;
+        if (amortized && model->faces_capacity < 2 * model->faces_count)
+            model->faces_capacity = 2 * model->faces_count;
+        if (!(model->faces = realloc(model->faces, model->faces_capacity * sizeof(*model->faces))))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+    }
 }
 
 static int obj_derelativize_idx(int i, int n)
@@ -72,6 +119,7 @@ static int obj_derelativize_idx(int i, int n)
 
 static bool model_validate_idxs(struct model *model)
 {
+    unsigned long long start_time = get_current_useconds();
     bool valid = true;
 
     for (int f = 0; f < model->faces_count; ++f)
@@ -86,6 +134,7 @@ static bool model_validate_idxs(struct model *model)
             }
         }
     }
+    model->load_stats.validate_useconds = get_current_useconds() - start_time;
     return valid;
 }
 
@@ -93,6 +142,7 @@ static void model_add_face(struct model *model, int idx1, int idx2, int idx3, in
 {
     if (model->faces_count == model->faces_capacity)
     {
+        model->load_stats.allocations++;
         model->faces_capacity *= 2;
         if (!(model->faces = realloc(model->faces, model->faces_capacity * sizeof(*model->faces))))
         {
@@ -108,16 +158,68 @@ static void model_add_face(struct model *model, int idx1, int idx2, int idx3, in
     model->faces_count++;
 }
 
-static void model_add_material(struct model *model, const char *name, float d_r, float d_g, float d_b)
+static unsigned int material_name_hash(const char *name, size_t len)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= (unsigned char) name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool material_name_equals(const struct material *material, const char *name, size_t len)
+{
+    return strncmp(material->name, name, len) == 0 && material->name[len] == '\0';
+}
+
+// Slot of the material index table for the name, either holding it or empty.
+static unsigned int model_material_slot(const struct model *model, const char *name, size_t len)
+{
+    unsigned int mask = model->material_table_size - 1;
+    unsigned int slot = material_name_hash(name, len) & mask;
+
+    while (model->material_table[slot] != 0)
+    {
+        if (material_name_equals(&model->materials[model->material_table[slot] - 1], name, len))
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static void model_grow_material_table(struct model *model)
 {
-    if (strlen(name) >= MATERIAL_NAME_BUFFER_SIZE)
+    unsigned int *old_table = model->material_table;
+    unsigned int old_size = model->material_table_size;
+
+    model->material_table_size = (old_size == 0) ? 16 : 2 * old_size;
+    if (!(model->material_table = calloc(model->material_table_size, sizeof(*model->material_table))))
     {
-        fprintf(stderr, "ERROR: Material name too long.\n");
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
         exit(1);
     }
+    model->load_stats.allocations++;
+
+    for (unsigned int i = 0; i < old_size; ++i)
+    {
+        if (old_table[i] == 0)
+            continue;
+
+        const char *name = model->materials[old_table[i] - 1].name;
+        model->material_table[model_material_slot(model, name, strlen(name))] = old_table[i];
+    }
+    free(old_table);
+}
 
+static void model_add_material(struct model *model, const char *name, size_t len,
+        float d_r, float d_g, float d_b)
+{
     if (model->materials_count == model->materials_capacity)
     {
+        model->load_stats.allocations++;
         model->materials_capacity *= 2;
         if (!(model->materials = realloc(model->materials, model->materials_capacity * sizeof(*model->materials))))
         {
@@ -126,22 +228,33 @@ static void model_add_material(struct model *model, const char *name, float d_r,
         }
     }
 
-    strcpy(model->materials[model->materials_count].name, name);
+    // Interned name
+    char *name_copy = arena_alloc(&model->material_names, len + 1);
+    memcpy(name_copy, name, len);
+    name_copy[len] = '\0';
+
+    model->materials[model->materials_count].name = name_copy;
     model->materials[model->materials_count].Kd_r = d_r;
     model->materials[model->materials_count].Kd_g = d_g;
     model->materials[model->materials_count].Kd_b = d_b;
 
     model->materials_count++;
+
+    // Index it, unless the name is repeated: the first material with the name is the one used.
+    if (2 * model->materials_count > model->material_table_size)
+        model_grow_material_table(model);
+
+    unsigned int slot = model_material_slot(model, name, len);
+    if (model->material_table[slot] == 0)
+        model->material_table[slot] = model->materials_count;
 }
 
-int model_get_material_idx(struct model *model, const char *name)
+static int model_get_material_idx(const struct model *model, const char *name, size_t len)
 {
-    for (int i = 0; i < model->materials_count; ++i)
-    {
-        if (strcmp(model->materials[i].name, name) == 0)
-            return i;
-    }
-    return -1;
+    if (model->material_table_size == 0)
+        return -1;
+
+    return (int) model->material_table[model_material_slot(model, name, len)] - 1;
 }
 
 void model_invert_triangles(struct model *model)
@@ -176,6 +289,281 @@ void model_normalize(struct model *model)
     }
 }
 
+// Grid resolution used to quantize positions (per bounding box axis) when welding vertexes.
+#define WELD_GRID_SIZE (1 << 21)
+
+static unsigned int weld_hash(const unsigned int q[3])
+{
+    unsigned int h = q[0] * 73856093u;
+    h ^= q[1] * 19349663u;
+    h ^= q[2] * 83492791u;
+    return h ^ (h >> 15);
+}
+
+static void weld_quantize(vec3 v, vec3 min, float scale, unsigned int q[3])
+{
+    q[0] = (unsigned int) ((v.x - min.x) * scale + 0.5f);
+    q[1] = (unsigned int) ((v.y - min.y) * scale + 0.5f);
+    q[2] = (unsigned int) ((v.z - min.z) * scale + 0.5f);
+}
+
+void model_weld_vertexes(struct model *model)
+{
+    if (model->vertex_count == 0)
+        return;
+
+    // Quantization grid over the bounding box
+    vec3 min = model->vertexes[0];
+    vec3 max = model->vertexes[0];
+    for (unsigned int i = 1; i < model->vertex_count; ++i)
+    {
+        vec3 v = model->vertexes[i];
+        min.x = fminf(min.x, v.x);
+        min.y = fminf(min.y, v.y);
+        min.z = fminf(min.z, v.z);
+        max.x = fmaxf(max.x, v.x);
+        max.y = fmaxf(max.y, v.y);
+        max.z = fmaxf(max.z, v.z);
+    }
+    float extent = fmaxf(max.x - min.x, fmaxf(max.y - min.y, max.z - min.z));
+    float scale = (extent > 0) ? WELD_GRID_SIZE / extent : 0;
+
+    // Open addressing table from quantized position to the new vertex index
+    unsigned int table_size = 1;
+    while (table_size < 2 * model->vertex_count)
+        table_size *= 2;
+
+    unsigned int *table;
+    unsigned int *remap;
+    if (!(table = malloc(table_size * sizeof(*table))) ||
+            !(remap = malloc(model->vertex_count * sizeof(*remap))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+    memset(table, 0xff, table_size * sizeof(*table));
+
+    unsigned int welded_count = 0;
+    for (unsigned int i = 0; i < model->vertex_count; ++i)
+    {
+        unsigned int q[3];
+        weld_quantize(model->vertexes[i], min, scale, q);
+
+        unsigned int slot = weld_hash(q) & (table_size - 1);
+        while (table[slot] != UINT_MAX)
+        {
+            unsigned int q2[3];
+            weld_quantize(model->vertexes[table[slot]], min, scale, q2);
+            if (q[0] == q2[0] && q[1] == q2[1] && q[2] == q2[2])
+                break;
+            slot = (slot + 1) & (table_size - 1);
+        }
+
+        if (table[slot] == UINT_MAX)
+        {
+            // New vertex, welded vertexes are compacted in place, as welded_count <= i.
+            table[slot] = welded_count;
+            model->vertexes[welded_count] = model->vertexes[i];
+            welded_count++;
+        }
+        remap[i] = table[slot];
+    }
+
+    // Rewrite face indexes, dropping faces that became degenerate
+    unsigned int faces_count = 0;
+    for (unsigned int f = 0; f < model->faces_count; ++f)
+    {
+        struct face face = model->faces[f];
+        for (int i = 0; i < 3; ++i)
+            face.idxs[i] = remap[face.idxs[i]];
+
+        if (face.idxs[0] == face.idxs[1] || face.idxs[1] == face.idxs[2] || face.idxs[2] == face.idxs[0])
+            continue;
+
+        model->faces[faces_count++] = face;
+    }
+
+    model->load_stats.welded_vertexes += model->vertex_count - welded_count;
+    model->vertex_count = welded_count;
+    model->faces_count = faces_count;
+
+    // Release the memory of the merged vertexes
+    model->vertex_capacity = (welded_count > 0) ? welded_count : 1;
+    if (!(model->vertexes = realloc(model->vertexes, model->vertex_capacity * sizeof(*model->vertexes))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+
+    free(table);
+    free(remap);
+}
+
+// Cell of the simplification grid, with the quadric error of the planes of its faces.
+struct simplify_cluster
+{
+    unsigned int q[3];
+    // Upper triangle of the 4x4 quadric matrix.
+    float quadric[10];
+    vec3 sum;
+    unsigned int count;
+};
+
+static void simplify_add_plane(float *quadric, vec3 p, vec3 normal)
+{
+    // Weighted by the area of the face, the normal length is twice the area.
+    float mag = vec3_mag(normal);
+    if (mag == 0)
+        return;
+    float w = 0.5f / mag;
+
+    float a = normal.x, b = normal.y, c = normal.z;
+    float d = -vec3_dot_product(normal, p);
+
+    quadric[0] += w * a * a;
+    quadric[1] += w * a * b;
+    quadric[2] += w * a * c;
+    quadric[3] += w * a * d;
+    quadric[4] += w * b * b;
+    quadric[5] += w * b * c;
+    quadric[6] += w * b * d;
+    quadric[7] += w * c * c;
+    quadric[8] += w * c * d;
+    quadric[9] += w * d * d;
+}
+
+// Position of the cluster: the one with the smallest quadric error, if it's inside the cell,
+// otherwise the mean of its vertexes, so it never moves further than the cell diagonal.
+static vec3 simplify_cluster_position(const struct simplify_cluster *cluster, vec3 min, float cell_size)
+{
+    vec3 mean = {cluster->sum.x / cluster->count, cluster->sum.y / cluster->count,
+            cluster->sum.z / cluster->count};
+
+    const float *q = cluster->quadric;
+    double a00 = q[0], a01 = q[1], a02 = q[2], a11 = q[4], a12 = q[5], a22 = q[7];
+    double b0 = -q[3], b1 = -q[6], b2 = -q[8];
+
+    double c00 = a11 * a22 - a12 * a12;
+    double c01 = a02 * a12 - a01 * a22;
+    double c02 = a01 * a12 - a02 * a11;
+    double det = a00 * c00 + a01 * c01 + a02 * c02;
+
+    double scale = a00 + a11 + a22;
+    if (fabs(det) <= 1e-6 * scale * scale * scale)
+        return mean;
+
+    double c11 = a00 * a22 - a02 * a02;
+    double c12 = a01 * a02 - a00 * a12;
+    double c22 = a00 * a11 - a01 * a01;
+
+    vec3 p;
+    p.x = (c00 * b0 + c01 * b1 + c02 * b2) / det;
+    p.y = (c01 * b0 + c11 * b1 + c12 * b2) / det;
+    p.z = (c02 * b0 + c12 * b1 + c22 * b2) / det;
+
+    vec3 cell_min = {min.x + cluster->q[0] * cell_size, min.y + cluster->q[1] * cell_size,
+            min.z + cluster->q[2] * cell_size};
+    if (p.x < cell_min.x || p.x > cell_min.x + cell_size || p.y < cell_min.y ||
+            p.y > cell_min.y + cell_size || p.z < cell_min.z || p.z > cell_min.z + cell_size)
+    {
+        return mean;
+    }
+    return p;
+}
+
+struct model *model_simplify(const struct model *model, vec3 min, float cell_size)
+{
+    struct model *simple = model_init();
+    if (model->vertex_count == 0 || cell_size <= 0)
+        return simple;
+
+    // Open addressing table from cell to cluster, as in model_weld_vertexes
+    unsigned int table_size = 1;
+    while (table_size < 2 * model->vertex_count)
+        table_size *= 2;
+
+    unsigned int *table;
+    unsigned int *remap;
+    struct simplify_cluster *clusters;
+    if (!(table = malloc(table_size * sizeof(*table))) ||
+            !(remap = malloc(model->vertex_count * sizeof(*remap))) ||
+            !(clusters = malloc(model->vertex_count * sizeof(*clusters))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+    memset(table, 0xff, table_size * sizeof(*table));
+
+    unsigned int clusters_count = 0;
+    for (unsigned int i = 0; i < model->vertex_count; ++i)
+    {
+        vec3 v = model->vertexes[i];
+        unsigned int q[3];
+        q[0] = (unsigned int) ((v.x - min.x) / cell_size);
+        q[1] = (unsigned int) ((v.y - min.y) / cell_size);
+        q[2] = (unsigned int) ((v.z - min.z) / cell_size);
+
+        unsigned int slot = weld_hash(q) & (table_size - 1);
+        while (table[slot] != UINT_MAX)
+        {
+            const unsigned int *q2 = clusters[table[slot]].q;
+            if (q[0] == q2[0] && q[1] == q2[1] && q[2] == q2[2])
+                break;
+            slot = (slot + 1) & (table_size - 1);
+        }
+
+        if (table[slot] == UINT_MAX)
+        {
+            struct simplify_cluster *cluster = &clusters[clusters_count];
+            memcpy(cluster->q, q, sizeof(q));
+            memset(cluster->quadric, 0, sizeof(cluster->quadric));
+            cluster->sum = (vec3){0, 0, 0};
+            cluster->count = 0;
+            table[slot] = clusters_count++;
+        }
+
+        struct simplify_cluster *cluster = &clusters[table[slot]];
+        cluster->sum = vec3_add(cluster->sum, v);
+        cluster->count++;
+        remap[i] = table[slot];
+    }
+
+    // Quadrics of the planes around each cluster
+    for (unsigned int f = 0; f < model->faces_count; ++f)
+    {
+        const unsigned int *idxs = model->faces[f].idxs;
+        vec3 p1 = model->vertexes[idxs[0]];
+        vec3 normal = vec3_cross_product(vec3_sub(model->vertexes[idxs[1]], p1),
+                vec3_sub(model->vertexes[idxs[2]], p1));
+
+        for (int k = 0; k < 3; ++k)
+            simplify_add_plane(clusters[remap[idxs[k]]].quadric, p1, normal);
+    }
+
+    model_reserve(simple, clusters_count, model->faces_count, false);
+    for (unsigned int c = 0; c < clusters_count; ++c)
+        simple->vertexes[c] = simplify_cluster_position(&clusters[c], min, cell_size);
+    simple->vertex_count = clusters_count;
+
+    // Faces that collapsed to a line or a point are dropped
+    for (unsigned int f = 0; f < model->faces_count; ++f)
+    {
+        struct face face = model->faces[f];
+        for (int k = 0; k < 3; ++k)
+            face.idxs[k] = remap[face.idxs[k]];
+
+        if (face.idxs[0] == face.idxs[1] || face.idxs[1] == face.idxs[2] || face.idxs[2] == face.idxs[0])
+            continue;
+
+        simple->faces[simple->faces_count++] = face;
+    }
+
+    free(clusters);
+    free(remap);
+    free(table);
+    return simple;
+}
+
 void model_change_orientation(struct model *model, int axis1, int axis2, int axis3)
 {
     assert(0 <= axis1 && axis1 <= 2);
@@ -229,136 +617,296 @@ void model_invert_z(struct model *model)
     model_invert_triangles(model);
 }
 
+void model_orient(struct model *model, const struct model_orientation *orientation)
+{
+    const int *axes = orientation->axes;
+    if (axes[0] != 0 || axes[1] != 1 || axes[2] != 2)
+        model_change_orientation(model, axes[0], axes[1], axes[2]);
+    if (orientation->axes_flip_faces)
+        model_invert_triangles(model);
+
+    if (orientation->flip_faces)
+        model_invert_triangles(model);
+
+    if (orientation->invert_x)
+        model_invert_x(model);
+    if (orientation->invert_y)
+        model_invert_y(model);
+    if (orientation->invert_z)
+        model_invert_z(model);
+}
+
+void model_release_geometry(struct model *model)
+{
+    if (model->storage.data)
+    {
+        mapped_file_close(&model->storage);
+    }
+    else
+    {
+        free(model->vertexes);
+        free(model->faces);
+    }
+    vertex_soa_free(&model->soa);
+    free(model->normals);
+    free(model->clusters);
+    free(model->cluster_nodes);
+    free(model->static_chars);
+    model->normals = NULL;
+    model->normals_count = 0;
+    model->clusters = NULL;
+    model->clusters_count = 0;
+    model->cluster_nodes = NULL;
+    model->cluster_nodes_count = 0;
+    model->static_chars = NULL;
+    model->vertexes = NULL;
+    model->faces = NULL;
+    model->vertex_count = model->vertex_capacity = 0;
+    model->faces_count = model->faces_capacity = 0;
+}
+
 void model_free(struct model *model)
 {
-    free(model->vertexes);
-    free(model->faces);
+    model_release_geometry(model);
     free(model->materials);
+    arena_free(&model->material_names);
+    free(model->material_table);
     free(model);
 }
 
-// Breaks the string the first time the delim substring is encountered,
-// returns the first part of the string.
-// The *str pointer is updated to the position after the delim, or NULL if the string ends.
-static char *str_chop(char **str, char *delim)
+void model_compute_soa(struct model *model, unsigned int first_vertex)
 {
-    int delim_i = 0;
-    char *ret = *str;
-    char *p = *str;
+    vertex_soa_copy(&model->soa, model->vertexes, first_vertex, model->vertex_count);
+}
 
-    assert(*delim != '\0');
+struct vertex_bounds model_bounds(const struct model *model)
+{
+    if (model->soa.count == model->vertex_count)
+        return vertex_kernel_bounds(&model->soa);
+
+    struct vertex_soa soa = {0};
+    vertex_soa_copy(&soa, model->vertexes, 0, model->vertex_count);
+    struct vertex_bounds bounds = vertex_kernel_bounds(&soa);
+    vertex_soa_free(&soa);
+    return bounds;
+}
 
-    if (p == NULL)
-        return NULL;
+void model_compute_normals(struct model *model, unsigned int first_face)
+{
+    if (model->faces_count == 0)
+    {
+        free(model->normals);
+        model->normals = NULL;
+        model->normals_count = 0;
+        return;
+    }
 
-    while (*p != '\0')
+    if (!(model->normals = realloc(model->normals, model->faces_count * sizeof(*model->normals))))
     {
-        if (*p == delim[delim_i])
-            delim_i++;
-        else
-            delim_i = 0;
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
 
-        p++;
+    for (unsigned int f = first_face; f < model->faces_count; ++f)
+    {
+        const unsigned int *idxs = model->faces[f].idxs;
+        vec3 p1 = model->vertexes[idxs[0]];
+        vec3 normal = vec3_cross_product(vec3_sub(model->vertexes[idxs[1]], p1),
+                vec3_sub(model->vertexes[idxs[2]], p1));
+        model->normals[f] = vec3_normalize(normal);
+    }
+    model->normals_count = model->faces_count;
+}
 
-        if (delim[delim_i] == '\0')
-        {
-            p[-delim_i] = '\0';
+struct model model_tail(const struct model *model, unsigned int first_vertex, unsigned int first_face)
+{
+    struct model tail = {0};
+    tail.vertex_count = model->vertex_count - first_vertex;
+    tail.vertex_capacity = tail.vertex_count;
+    tail.vertexes = model->vertexes + first_vertex;
+    tail.faces_count = model->faces_count - first_face;
+    tail.faces_capacity = tail.faces_count;
+    tail.faces = model->faces + first_face;
+    return tail;
+}
 
-            *str = p;
-            return ret;
-        }
+void model_progress_init(struct model_progress *progress)
+{
+    pthread_mutex_init(&progress->mutex, NULL);
+    progress->model = NULL;
+    progress->vertex_count = 0;
+    progress->faces_count = 0;
+    progress->materials_count = 0;
+    progress->complete = false;
+    progress->cancelled = false;
+    progress->samples_count = 0;
+    progress->samples_ready = false;
+    progress->bytes_total = 0;
+    progress->bytes_done = 0;
+    progress->copied_vertexes = 0;
+    progress->copied_faces = 0;
+}
+
+void model_progress_destroy(struct model_progress *progress)
+{
+    pthread_mutex_destroy(&progress->mutex);
+}
+
+struct model *model_progress_samples(struct model_progress *progress)
+{
+    struct model *model = NULL;
+
+    pthread_mutex_lock(&progress->mutex);
+    if (progress->samples_ready && progress->samples_count > 0)
+    {
+        model = model_init();
+        model_reserve(model, progress->samples_count, 0, false);
+        memcpy(model->vertexes, progress->samples, progress->samples_count * sizeof(vec3));
+        model->vertex_count = progress->samples_count;
     }
+    pthread_mutex_unlock(&progress->mutex);
 
-    *str = NULL;
-    return ret;
+    return model;
 }
 
-static char *str_chop_skip_empty(char **str, char *delim)
+bool model_progress_copy(struct model_progress *progress, struct model *dst)
 {
-    char *res;
+    pthread_mutex_lock(&progress->mutex);
 
-    while ((res = str_chop(str, delim)))
+    const struct model *src = progress->model;
+    bool changed = false;
+
+    if (src && !progress->complete)
     {
-        if (res[0] != '\0')
-            return res;
+        for (unsigned int m = dst->materials_count; m < progress->materials_count; ++m)
+        {
+            const struct material *material = &src->materials[m];
+            model_add_material(dst, material->name, strlen(material->name), material->Kd_r,
+                    material->Kd_g, material->Kd_b);
+        }
+
+        unsigned int vertexes = progress->vertex_count - progress->copied_vertexes;
+        unsigned int faces = progress->faces_count - progress->copied_faces;
+        model_reserve(dst, vertexes, faces, true);
+
+        memcpy(&dst->vertexes[dst->vertex_count], &src->vertexes[progress->copied_vertexes],
+                vertexes * sizeof(vec3));
+        dst->vertex_count += vertexes;
+
+        // Stop at the first face with vertexes that are not loaded yet, it is retried on the next call
+        unsigned int f = progress->copied_faces;
+        while (f < progress->faces_count)
+        {
+            const struct face *face = &src->faces[f];
+            if (face->idxs[0] >= dst->vertex_count || face->idxs[1] >= dst->vertex_count
+                    || face->idxs[2] >= dst->vertex_count)
+                break;
+            dst->faces[dst->faces_count++] = *face;
+            f++;
+        }
+
+        changed = vertexes > 0 || f > progress->copied_faces;
+        progress->copied_vertexes = progress->vertex_count;
+        progress->copied_faces = f;
     }
-    return NULL;
+
+    pthread_mutex_unlock(&progress->mutex);
+    return changed;
 }
 
-static bool parse_float(char **buffer, float *f)
+static void progress_lock(struct model_progress *progress)
 {
-    char *arg = str_chop_skip_empty(buffer, " ");
-    if (!arg)
-        return false;
-    char *f_str = str_chop(&arg, "/");
-    *f = (float) atof(f_str);
-    return true;
+    if (progress)
+        pthread_mutex_lock(&progress->mutex);
 }
 
-static bool parse_int(char **buffer, int *i)
+static void progress_unlock(struct model_progress *progress)
 {
-    char *arg = str_chop_skip_empty(buffer, " ");
-    if (!arg)
-        return false;
-    char *i_str = str_chop(&arg, "/");
-    *i = atoi(i_str);
-    return true;
+    if (progress)
+        pthread_mutex_unlock(&progress->mutex);
 }
 
-// Remove end-of-line characters and turn tabs into spaces
-static void string_strip(char *str)
+// Publish the current vertexes, faces and materials of the model, holding the progress lock.
+static void progress_publish(struct model_progress *progress, const struct model *model,
+        unsigned long long bytes_done)
 {
-    char *p = str;
-    while (*p)
-    {
-        if (*p == '\n' || *p == '\r')
-            *p = '\0';
-        if (*p == '\t')
-            *p = ' ';
-        p++;
-    }
+    progress->model = model;
+    progress->vertex_count = model->vertex_count;
+    progress->faces_count = model->faces_count;
+    progress->materials_count = model->materials_count;
+    progress->bytes_done = bytes_done;
+}
+
+static bool progress_cancelled(struct model_progress *progress)
+{
+    progress_lock(progress);
+    bool cancelled = progress && progress->cancelled;
+    progress_unlock(progress);
+    return cancelled;
+}
+
+static void progress_complete(struct model_progress *progress)
+{
+    progress_lock(progress);
+    if (progress)
+        progress->complete = true;
+    progress_unlock(progress);
+}
+
+// Sample the bounds from vertexes spread over the given ones, holding the progress lock.
+static void progress_sample_vertexes(struct model_progress *progress, const vec3 *vertexes,
+        unsigned int count)
+{
+    int samples = (count < MODEL_PROGRESS_SAMPLES) ? count : MODEL_PROGRESS_SAMPLES;
+    for (int k = 0; k < samples; ++k)
+        progress->samples[k] = vertexes[(unsigned long long) count * k / samples];
+    progress->samples_count = samples;
+    progress->samples_ready = true;
 }
 
 static void model_load_materials_from_mtl(struct model *model, const char *mtl_fname)
 {
-    FILE *fp = fopen(mtl_fname, "r");
-    if (!fp)
+    struct mapped_file file;
+    if (!mapped_file_open(&file, mtl_fname, false))
     {
         fprintf(stderr, "WARN: failed to load file \"%s\".\n", mtl_fname);
         return;
     }
 
-    // Read each line of the file
-    char buffer[256];
+    // Scan each line of the file, in place
+    const char *file_end = file.data + file.size;
+    const char *line_end;
 
-    while (fgets(buffer, sizeof(buffer), fp))
+    for (const char *line = file.data; line < file_end; line = line_end + 1)
     {
-        string_strip(buffer);
+        line_end = scan_line_end(line, file_end);
 
-        char *bufferp = buffer;
-        char *instr = str_chop_skip_empty(&bufferp, " ");
+        struct scanner sc = {.p = line, .end = line_end};
+        const char *instr;
+        size_t instr_len = scan_token(&sc, &instr);
 
-        if (!instr || instr[0] == '#')
+        if (instr_len == 0 || instr[0] == '#')
             continue;
 
-        if (strcmp(instr, "newmtl") == 0)
+        if (scan_token_equals(instr, instr_len, "newmtl"))
         {
-            const char *name = str_chop_skip_empty(&bufferp, " ");
+            const char *name;
+            size_t name_len = scan_token(&sc, &name);
 
-            model_add_material(model, name, 1.0, 1.0, 1.0);
+            model_add_material(model, name, name_len, 1.0, 1.0, 1.0);
         }
-        else if (strcmp(instr, "Kd") == 0)
+        else if (scan_token_equals(instr, instr_len, "Kd"))
         {
             if (model->materials_count == 0)
             {
-                fprintf(stderr, "WARN: Expected newmtl before \"%s\" instruction.\n", instr);
+                fprintf(stderr, "WARN: Expected newmtl before \"Kd\" instruction.\n");
                 continue;
             }
 
             float r, g, b;
-            if (!parse_float(&bufferp, &r) || !parse_float(&bufferp, &g) || !parse_float(&bufferp, &b))
+            if (!scan_float(&sc, &r) || !scan_float(&sc, &g) || !scan_float(&sc, &b))
             {
-                fprintf(stderr, "WARN: invalid \"%s\" instruction.\n", instr);
+                fprintf(stderr, "WARN: invalid \"Kd\" instruction.\n");
                 continue;
             }
 
@@ -368,332 +916,2373 @@ static void model_load_materials_from_mtl(struct model *model, const char *mtl_f
         }
     }
 
-    fclose(fp);
+    mapped_file_close(&file);
 }
 
-// Read a line, duplicating the size of the buffer if necessary, using only gets() for portability.
-static char *read_line(char **buffer, int *buffer_size, FILE *fp)
+static void model_load_obj_mtllib(struct model *model, const char *fname, const char *name,
+        const char *name_end)
 {
-    if (!fgets(*buffer, *buffer_size, fp))
-        return NULL;
-
-    while ((*buffer)[strlen(*buffer) - 1] != '\n')
+    // Mutable copy of fname
+    char *fname2;
+    if (!(fname2 = malloc(strlen(fname) + 2)))
     {
-        if (!(*buffer = realloc(*buffer, *buffer_size * 2)))
-        {
-            fprintf(stderr, "ERROR: Memory allocation failure.\n");
-            exit(1);
-        }
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+    strcpy(fname2, fname);
 
-        if (!fgets(*buffer + *buffer_size - 1, *buffer_size + 1, fp))
-        {
-            *buffer_size *= 2;
-            return NULL;
-        }
+    // MTL file location
+    const char *fname_dirname = dirname(fname2);
+    size_t mtl_fname_size = strlen(fname_dirname) + (name_end - name) + 2;
 
-        *buffer_size *= 2;
+    char *mtl_fname;
+    if (!(mtl_fname = malloc(mtl_fname_size)))
+    {
+        free(fname2);
+        fprintf(stderr, "ERROR: Memory allocation failure for MTL file name.\n");
+        exit(1);
     }
-    return *buffer;
+    strcpy(mtl_fname, fname_dirname);
+    strcat(mtl_fname, "/");
+    strncat(mtl_fname, name, name_end - name);
+
+    fprintf(stderr, "NOTE: Reading \"%s\".\n", mtl_fname);
+
+    model_load_materials_from_mtl(model, mtl_fname);
+
+    free(fname2);
+    free(mtl_fname);
 }
 
-struct model *model_load_from_obj(const char *fname, bool color_support)
+// Minimum number of bytes of an OBJ file for each parsing thread.
+#define OBJ_MIN_CHUNK_SIZE (1 << 20)
+
+// Size of the parts of an OBJ file that are loaded at once, when loading it progressively.
+#define OBJ_PROGRESSIVE_PART_SIZE (1 << 23)
+// Decompressed blocks kept for each parsing thread, when loading a compressed OBJ file.
+#define OBJ_STREAM_BLOCKS_PER_THREAD 2
+// Lines searched for a vertex from each sampling position.
+#define OBJ_SAMPLE_MAX_LINES 64
+
+#define OBJ_IDXS_BLOCK_SIZE (1 << 20)
+#define OBJ_SCRATCH_BLOCK_SIZE (1 << 12)
+
+// Face as read from the file, its indexes are not derelativized yet.
+struct obj_face_record
 {
-    FILE *fp = fopen(fname, "r");
-    if (!fp)
-    {
-        fprintf(stderr, "ERROR: failed to load file \"%s\".\n", fname);
-        return NULL;
-    }
+    int *idxs;
+    unsigned int idx_count;
+    // Vertexes read in the chunk before this face, for relative indexes.
+    unsigned int vertex_count;
+    // Last "usemtl" event in the chunk before this face, -1 if none.
+    int usemtl_event;
+};
+
+// Instruction that has to be processed in order when the chunks are merged.
+struct obj_event
+{
+    bool is_usemtl; // Otherwise it is "mtllib".
+    const char *name;
+    const char *name_end;
+    int material;
+};
+
+// Newline aligned part of an OBJ file, parsed by its own thread.
+struct obj_chunk
+{
+    const char *begin, *end;
+    bool failed;
 
-    // Create a new model
-    struct model *model = model_init();
+    struct seg_array vertexes;
+    struct seg_array records;
+    struct seg_array events;
 
-    int current_material = -1;
+    // Storage for the indexes of the face records and the names of the events.
+    struct arena idxs;
+    // Temporaries of the face being triangularized.
+    struct arena scratch;
 
-    // Read each line of the file
-    int buffer_size = 128;
-    char *buffer;
+    // Index of the first vertex of the chunk in the model.
+    unsigned int vertex_base;
+    // Lowest index that was not loaded when the faces were triangularized.
+    unsigned int unresolved_idx;
 
-    if (!(buffer = malloc(buffer_size)))
-    {
-        fprintf(stderr, "ERROR: Memory allocation failure.\n");
-        exit(1);
-    }
+    // Triangulated faces, the material holds the usemtl_event until the merge.
+    struct seg_array faces;
+};
+
+struct obj_parse
+{
+    bool color_support;
+    int threads_count;
+    // Chunks of the part of the file being loaded.
+    int chunks_count;
+    struct obj_chunk *chunks;
+    const struct model *model;
+    // Material set by the last usemtl of the previous chunks.
+    int current_material;
+    // Lowest index that was not loaded when the faces were triangularized.
+    unsigned int unresolved_idx;
+};
+
+static void obj_chunk_add_event(struct obj_chunk *chunk, bool is_usemtl, const char *name,
+        const char *name_end)
+{
+    // The names are copied, the text of the chunk may be released before the chunks are merged.
+    size_t len = name_end - name;
+    char *copy = arena_alloc(&chunk->idxs, len);
+    memcpy(copy, name, len);
+
+    struct obj_event *event = seg_array_push(&chunk->events);
+    event->is_usemtl = is_usemtl;
+    event->name = copy;
+    event->name_end = copy + len;
+    event->material = -1;
+}
+
+// First pass over a chunk: read the vertexes, the face indexes and the material instructions.
+static void obj_chunk_parse(struct obj_chunk *chunk, bool color_support)
+{
+    int usemtl_event = -1;
+
+    const char *line_end;
 
-    while (read_line(&buffer, &buffer_size, fp))
+    for (const char *line = chunk->begin; line < chunk->end; line = line_end + 1)
     {
-        string_strip(buffer);
+        line_end = scan_line_end(line, chunk->end);
 
-        char *bufferp = buffer;
-        char *instr = str_chop_skip_empty(&bufferp, " ");
+        struct scanner sc = {.p = line, .end = line_end};
+        const char *instr;
+        size_t instr_len = scan_token(&sc, &instr);
 
-        if (!instr || instr[0] == '#')
+        if (instr_len == 0 || instr[0] == '#')
             continue;
 
-        if (strcmp(instr, "v") == 0)
+        if (scan_token_equals(instr, instr_len, "v"))
         {
-            float f1, f2, f3;
+            vec3 vec;
 
-            if (!parse_float(&bufferp, &f1) || !parse_float(&bufferp, &f2) || !parse_float(&bufferp, &f3))
+            if (!scan_float(&sc, &vec.x) || !scan_float(&sc, &vec.y) || !scan_float(&sc, &vec.z))
             {
                 fprintf(stderr, "ERROR: invalid \"v\" instruction.\n");
-                fclose(fp);
-                model_free(model);
-                return NULL;
+                chunk->failed = true;
+                return;
             }
 
-            vec3 vec;
-            vec.x = f1;
-            vec.y = f2;
-            vec.z = f3;
-
-            model_add_vertex(model, vec);
+            *(vec3 *) seg_array_push(&chunk->vertexes) = vec;
         }
-        else if (strcmp(instr, "f") == 0)
+        else if (scan_token_equals(instr, instr_len, "f"))
         {
-            // Parse face indexes
-            int idx_count = 0;
-            int idx_capacity = 1;
-            int *idxs = malloc(idx_capacity * sizeof(int));
-
-            int idx_read;
-            while (parse_int(&bufferp, &idx_read))
-            {
-                if (idx_count == idx_capacity)
-                {
-                    idx_capacity *= 2;
-                    idxs = realloc(idxs, idx_capacity * sizeof(int));
-                }
-
-                int idx = obj_derelativize_idx(idx_read, model->vertex_count);
-                idxs[idx_count++] = idx;
-            }
+            // Count the indexes first, so they can be stored without reallocations
+            struct scanner sc_count = sc;
+            const char *tok;
+            unsigned int idx_count = 0;
+            while (scan_token(&sc_count, &tok) > 0)
+                idx_count++;
 
             if (idx_count < 3)
             {
                 fprintf(stderr, "ERROR: invalid \"f\" instruction.\n");
-                fclose(fp);
-                free(idxs);
-                model_free(model);
-                return NULL;
+                chunk->failed = true;
+                return;
             }
 
-            // Triangularize face
-            vec3 *vecs;
-            if (!(vecs = malloc(idx_count * sizeof(vec3))))
-            {
-                fprintf(stderr, "ERROR: Memory allocation failure.\n");
-                exit(1);
-            }
-            for (int i = 0; i < idx_count; ++i)
-                vecs[i] = model->vertexes[idxs[i]];
-
-            int *triangle_idxs;
-            if (!(triangle_idxs = malloc((idx_count - 2) * 3 * sizeof(int))))
-            {
-                fprintf(stderr, "ERROR: Memory allocation failure.\n");
-                exit(1);
-            }
-
-            triangularize(vecs, idx_count, triangle_idxs);
-
-            for (int i = 0; i < idx_count - 2; ++i)
-            {
-                int i1 = idxs[triangle_idxs[3 * i]];
-                int i2 = idxs[triangle_idxs[3 * i + 1]];
-                int i3 = idxs[triangle_idxs[3 * i + 2]];
+            struct obj_face_record *record = seg_array_push(&chunk->records);
+            record->idxs = arena_alloc(&chunk->idxs, idx_count * sizeof(int));
+            record->idx_count = idx_count;
+            record->vertex_count = chunk->vertexes.count;
+            record->usemtl_event = usemtl_event;
 
-                model_add_face(model, i1, i2, i3, current_material);
-            }
+            for (unsigned int i = 0; i < idx_count; ++i)
+                scan_int(&sc, &record->idxs[i]);
+        }
+        else if (color_support && scan_token_equals(instr, instr_len, "mtllib"))
+        {
+            // The file name is the rest of the line, after the separator.
+            const char *name = sc.p < sc.end ? sc.p + 1 : sc.p;
+            const char *name_end = name;
+            while (name_end < line_end && *name_end != '\r' && *name_end != '\0')
+                name_end++;
 
-            free(idxs);
-            free(vecs);
-            free(triangle_idxs);
+            obj_chunk_add_event(chunk, false, name, name_end);
         }
-        else if (color_support && strcmp(instr, "mtllib") == 0)
+        else if (color_support && scan_token_equals(instr, instr_len, "usemtl"))
         {
-            // Mutable copy of fname
-            char *fname2;
-            if (!(fname2 = malloc(strlen(fname) + 2)))
+            const char *name;
+            size_t name_len = scan_token(&sc, &name);
+
+            usemtl_event = chunk->events.count;
+            obj_chunk_add_event(chunk, true, name, name + name_len);
+        }
+    }
+}
+
+static void obj_parse_chunk_job(void *data, int index)
+{
+    struct obj_parse *parse = data;
+    obj_chunk_parse(&parse->chunks[index], parse->color_support);
+}
+
+// Second pass over a chunk: derelativize the indexes and triangularize the faces, once the
+// vertexes of all the chunks are in the model.
+static void obj_chunk_triangularize(struct obj_chunk *chunk, const struct model *model)
+{
+    for (size_t r = 0; r < chunk->records.count; ++r)
+    {
+        const struct obj_face_record *record = seg_array_at(&chunk->records, r);
+        int idx_count = record->idx_count;
+        int *idxs = record->idxs;
+
+        for (int i = 0; i < idx_count; ++i)
+            idxs[i] = obj_derelativize_idx(idxs[i], chunk->vertex_base + record->vertex_count);
+
+        // Triangularize face
+        arena_reset(&chunk->scratch);
+
+        vec3 *vecs = arena_alloc(&chunk->scratch, idx_count * sizeof(vec3));
+        for (int i = 0; i < idx_count; ++i)
+        {
+            // Invalid indexes are reported and fixed later by model_validate_idxs.
+            if ((unsigned int) idxs[i] < model->vertex_count)
+                vecs[i] = model->vertexes[idxs[i]];
+            else
             {
-                fprintf(stderr, "ERROR: Memory allocation failure.\n");
-                exit(1);
+                vecs[i] = (vec3){0, 0, 0};
+                if ((unsigned int) idxs[i] < chunk->unresolved_idx)
+                    chunk->unresolved_idx = idxs[i];
             }
-            strcpy(fname2, fname);
+        }
+
+        int *triangle_idxs = arena_alloc(&chunk->scratch, (idx_count - 2) * 3 * sizeof(int));
+
+        triangularize(vecs, idx_count, triangle_idxs, &chunk->scratch);
+
+        for (int i = 0; i < idx_count - 2; ++i)
+        {
+            struct face *face = seg_array_push(&chunk->faces);
+            face->idxs[0] = idxs[triangle_idxs[3 * i]];
+            face->idxs[1] = idxs[triangle_idxs[3 * i + 1]];
+            face->idxs[2] = idxs[triangle_idxs[3 * i + 2]];
+            face->material = record->usemtl_event;
+        }
+    }
+}
+
+static void obj_triangularize_job(void *data, int index)
+{
+    struct obj_parse *parse = data;
+    for (int c = index; c < parse->chunks_count; c += parse->threads_count)
+        obj_chunk_triangularize(&parse->chunks[c], parse->model);
+}
+
+static void obj_chunk_init(struct obj_chunk *chunk, const char *begin, const char *end)
+{
+    chunk->begin = begin;
+    chunk->end = end;
+    chunk->failed = false;
+    chunk->vertex_base = 0;
+    chunk->unresolved_idx = UINT_MAX;
+
+    seg_array_init(&chunk->vertexes, sizeof(vec3));
+    seg_array_init(&chunk->records, sizeof(struct obj_face_record));
+    seg_array_init(&chunk->events, sizeof(struct obj_event));
+    seg_array_init(&chunk->faces, sizeof(struct face));
+    arena_init(&chunk->idxs, OBJ_IDXS_BLOCK_SIZE);
+    arena_init(&chunk->scratch, OBJ_SCRATCH_BLOCK_SIZE);
+}
+
+// Free the chunk, returns the number of allocations it did.
+static unsigned long long obj_chunk_free(struct obj_chunk *chunk)
+{
+    unsigned long long allocations = chunk->vertexes.allocations + chunk->records.allocations
+        + chunk->events.allocations + chunk->faces.allocations + chunk->idxs.allocations
+        + chunk->scratch.allocations;
+
+    seg_array_free(&chunk->vertexes);
+    seg_array_free(&chunk->records);
+    seg_array_free(&chunk->events);
+    seg_array_free(&chunk->faces);
+    arena_free(&chunk->idxs);
+    arena_free(&chunk->scratch);
+
+    return allocations;
+}
+
+// Split the text into newline aligned chunks of similar size.
+static struct obj_chunk *obj_split_chunks(const char *text, size_t size, int chunks_count)
+{
+    struct obj_chunk *chunks;
+    if (!(chunks = malloc(chunks_count * sizeof(*chunks))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+
+    const char *text_end = text + size;
+    const char *begin = text;
+
+    for (int i = 0; i < chunks_count; ++i)
+    {
+        const char *end = text + (size / chunks_count) * (i + 1);
+        if (i == chunks_count - 1 || end < begin)
+            end = text_end;
+        else if (end < text_end)
+            end = scan_line_end(end, text_end);
+
+        obj_chunk_init(&chunks[i], begin, end);
+        begin = (end < text_end) ? end + 1 : text_end;
+    }
+    return chunks;
+}
+
+// Chunks parsed while a compressed file is being decompressed, one for each block of the file.
+struct obj_stream_parse
+{
+    bool color_support;
+    struct decompress_stream *stream;
+
+    // Maximum number of blocks to take, 0 for all of them.
+    size_t max_blocks;
+    // Index of the first block to take.
+    size_t first_block;
+
+    pthread_mutex_t mutex;
+    size_t blocks_taken;
+    struct obj_chunk **chunks;
+    size_t chunks_count;
+    size_t chunks_capacity;
+    unsigned long long bytes;
+};
+
+static void obj_stream_parse_job(void *data, int index)
+{
+    struct obj_stream_parse *sparse = data;
 
-            // MTL file location
-            const char *fname_dirname = dirname(fname2);
-            size_t mtl_fname_size = strlen(fname_dirname) + strlen(bufferp) + 2;
+    const char *text;
+    size_t size, block;
 
-            char *mtl_fname;
-            if (!(mtl_fname = malloc(mtl_fname_size)))
+    while (true)
+    {
+        pthread_mutex_lock(&sparse->mutex);
+        bool take = sparse->max_blocks == 0 || sparse->blocks_taken < sparse->max_blocks;
+        sparse->blocks_taken++;
+        pthread_mutex_unlock(&sparse->mutex);
+
+        if (!take || !decompress_stream_next(sparse->stream, &text, &size, &block))
+            break;
+
+        struct obj_chunk *chunk;
+        if (!(chunk = malloc(sizeof(*chunk))))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+        obj_chunk_init(chunk, text, text + size);
+        obj_chunk_parse(chunk, sparse->color_support);
+
+        // Nothing in the parsed chunk points into the text
+        decompress_stream_release(sparse->stream, block);
+        block -= sparse->first_block;
+
+        pthread_mutex_lock(&sparse->mutex);
+        if (block >= sparse->chunks_capacity)
+        {
+            size_t capacity = sparse->chunks_capacity ? sparse->chunks_capacity : 16;
+            while (capacity <= block)
+                capacity *= 2;
+
+            struct obj_chunk **chunks;
+            if (!(chunks = realloc(sparse->chunks, capacity * sizeof(*chunks))))
             {
-                free(fname2);
-                fprintf(stderr, "ERROR: Memory allocation failure for MTL file name.\n");
+                fprintf(stderr, "ERROR: Memory allocation failure.\n");
                 exit(1);
             }
-            strcpy(mtl_fname, fname_dirname);
-            strcat(mtl_fname, "/");
-            strcat(mtl_fname, bufferp);
+            sparse->chunks = chunks;
+            sparse->chunks_capacity = capacity;
+        }
+        sparse->chunks[block] = chunk;
+        if (sparse->chunks_count <= block)
+            sparse->chunks_count = block + 1;
+        sparse->bytes += size;
+        pthread_mutex_unlock(&sparse->mutex);
+    }
+}
+
+// Parse up to max_blocks blocks of the stream (0 for all of them) as they are decompressed, leaving
+// the chunks in the parse. Returns the number of decompressed bytes.
+static unsigned long long obj_parse_stream(struct obj_parse *parse, struct decompress_stream *stream,
+        size_t first_block, size_t max_blocks, struct model *model)
+{
+    struct obj_stream_parse sparse = {0};
+    sparse.color_support = parse->color_support;
+    sparse.stream = stream;
+    sparse.max_blocks = max_blocks;
+    sparse.first_block = first_block;
+    pthread_mutex_init(&sparse.mutex, NULL);
+
+    int threads_count = threads_get_count();
+    if (max_blocks > 0 && threads_count > max_blocks)
+        threads_count = max_blocks;
+    threads_run(threads_count, obj_stream_parse_job, &sparse);
+
+    pthread_mutex_destroy(&sparse.mutex);
+
+    // Blocks are taken in order, so all the slots are filled.
+    parse->chunks_count = sparse.chunks_count;
+    parse->chunks = NULL;
+    if (sparse.chunks_count > 0 && !(parse->chunks = malloc(sparse.chunks_count * sizeof(*parse->chunks))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+    for (size_t c = 0; c < sparse.chunks_count; ++c)
+    {
+        parse->chunks[c] = *sparse.chunks[c];
+        free(sparse.chunks[c]);
+    }
+    free(sparse.chunks);
+
+    model->load_stats.allocations += sparse.chunks_count + (sparse.chunks_capacity > 0);
+    return sparse.bytes;
+}
+
+// Merge the chunks into the model, in file order.
+static void obj_merge_chunks(struct model *model, const char *fname, struct obj_parse *parse)
+{
+    int current_material = parse->current_material;
+
+    for (int c = 0; c < parse->chunks_count; ++c)
+    {
+        struct obj_chunk *chunk = &parse->chunks[c];
+
+        for (size_t e = 0; e < chunk->events.count; ++e)
+        {
+            struct obj_event *event = seg_array_at(&chunk->events, e);
 
-            fprintf(stderr, "NOTE: Reading \"%s\".\n", mtl_fname);
+            if (event->is_usemtl)
+            {
+                event->material = model_get_material_idx(model, event->name,
+                        event->name_end - event->name);
+            }
+            else
+            {
+                model_load_obj_mtllib(model, fname, event->name, event->name_end);
+            }
+        }
 
-            model_load_materials_from_mtl(model, mtl_fname);
+        struct face *faces = &model->faces[model->faces_count];
+        seg_array_copy_to(&chunk->faces, faces);
+        model->faces_count += chunk->faces.count;
 
-            free(fname2);
-            free(mtl_fname);
+        if (chunk->events.count == 0)
+        {
+            for (size_t f = 0; f < chunk->faces.count; ++f)
+                faces[f].material = current_material;
+            continue;
         }
-        else if (color_support && strcmp(instr, "usemtl") == 0)
+
+        for (size_t f = 0; f < chunk->faces.count; ++f)
         {
-            const char *name = str_chop_skip_empty(&bufferp, " ");
+            int event = faces[f].material;
+            faces[f].material = (event < 0) ? current_material
+                    : ((struct obj_event *) seg_array_at(&chunk->events, event))->material;
+        }
 
-            current_material = model_get_material_idx(model, name);
+        // Last usemtl of the chunk sets the material for the following ones
+        for (size_t e = chunk->events.count; e > 0; --e)
+        {
+            const struct obj_event *event = seg_array_at(&chunk->events, e - 1);
+            if (event->is_usemtl)
+            {
+                current_material = event->material;
+                break;
+            }
         }
     }
 
-    free(buffer);
-    fclose(fp);
+    parse->current_material = current_material;
+}
 
-    model_validate_idxs(model);
-    return model;
+static void obj_free_chunks(struct model *model, struct obj_parse *parse)
+{
+    for (int c = 0; c < parse->chunks_count; ++c)
+        model->load_stats.allocations += obj_chunk_free(&parse->chunks[c]);
+    free(parse->chunks);
+    model->load_stats.allocations++;
 }
 
-struct model *model_load_from_stl(const char *fname)
+// Load the vertexes and faces of the parsed chunks into the model, publishing them if there is a
+// progress. Returns false if the chunks have errors.
+static bool obj_load_chunks(struct model *model, const char *fname, struct obj_parse *parse,
+        struct model_progress *progress, unsigned long long bytes_done)
 {
-    FILE *fp = fopen(fname, "rb");
-    if (!fp)
+    bool failed = false;
+    unsigned int vertex_count = 0;
+    for (int c = 0; c < parse->chunks_count; ++c)
+    {
+        failed = failed || parse->chunks[c].failed;
+        parse->chunks[c].vertex_base = model->vertex_count + vertex_count;
+        vertex_count += parse->chunks[c].vertexes.count;
+    }
+
+    if (failed)
+    {
+        obj_free_chunks(model, parse);
+        return false;
+    }
+
+    // Gather the vertexes, required to triangularize the faces
+    progress_lock(progress);
+    model_reserve(model, vertex_count, 0, progress != NULL);
+    for (int c = 0; c < parse->chunks_count; ++c)
+    {
+        seg_array_copy_to(&parse->chunks[c].vertexes, &model->vertexes[model->vertex_count]);
+        model->vertex_count += parse->chunks[c].vertexes.count;
+    }
+    progress_unlock(progress);
+
+    parse->threads_count = threads_get_count();
+    if (parse->threads_count > parse->chunks_count)
+        parse->threads_count = parse->chunks_count;
+    unsigned long long start_time = get_current_useconds();
+    threads_run(parse->threads_count, obj_triangularize_job, parse);
+    model->load_stats.triangularize_useconds += get_current_useconds() - start_time;
+
+    unsigned int faces_count = 0;
+    for (int c = 0; c < parse->chunks_count; ++c)
+        faces_count += parse->chunks[c].faces.count;
+
+    progress_lock(progress);
+    model_reserve(model, 0, faces_count, progress != NULL);
+    obj_merge_chunks(model, fname, parse);
+    if (progress)
+        progress_publish(progress, model, bytes_done);
+    progress_unlock(progress);
+
+    for (int c = 0; c < parse->chunks_count; ++c)
+    {
+        if (parse->chunks[c].unresolved_idx < parse->unresolved_idx)
+            parse->unresolved_idx = parse->chunks[c].unresolved_idx;
+    }
+
+    obj_free_chunks(model, parse);
+    return true;
+}
+
+// Sample the vertexes found after evenly spaced positions of the text, to estimate the bounds.
+static void obj_sample_vertexes(struct model_progress *progress, const char *text, size_t size)
+{
+    const char *text_end = text + size;
+    progress->samples_count = 0;
+
+    for (int k = 0; k < MODEL_PROGRESS_SAMPLES; ++k)
+    {
+        const char *line = text + (unsigned long long) size * k / MODEL_PROGRESS_SAMPLES;
+        if (k > 0)
+            line = scan_line_end(line, text_end) + 1;
+
+        // Look for a vertex in the following lines
+        for (int l = 0; l < OBJ_SAMPLE_MAX_LINES && line < text_end; ++l)
+        {
+            const char *line_end = scan_line_end(line, text_end);
+
+            struct scanner sc = {.p = line, .end = line_end};
+            const char *instr;
+            size_t instr_len = scan_token(&sc, &instr);
+            vec3 vec;
+
+            if (scan_token_equals(instr, instr_len, "v") && scan_float(&sc, &vec.x)
+                    && scan_float(&sc, &vec.y) && scan_float(&sc, &vec.z))
+            {
+                progress->samples[progress->samples_count++] = vec;
+                break;
+            }
+            line = line_end + 1;
+        }
+    }
+    progress->samples_ready = true;
+}
+
+struct model *model_load_from_obj(const char *fname, bool color_support, struct model_progress *progress)
+{
+    struct mapped_file file = {0};
+    struct decompress_stream *stream = NULL;
+    enum compression compression = compression_from_filename(fname);
+
+    if (compression != COMPRESSION_NONE)
+    {
+        if (!(stream = decompress_stream_open(fname, compression, OBJ_STREAM_BLOCKS_PER_THREAD
+                * threads_get_count())))
+            return NULL;
+    }
+    else if (!mapped_file_open(&file, fname, false))
     {
         fprintf(stderr, "ERROR: failed to load file \"%s\".\n", fname);
         return NULL;
     }
 
+    unsigned long long start_time = get_current_useconds();
+
     // Create a new model
     struct model *model = model_init();
 
-    // Read each line of the file
-    char buffer[256];
+    struct obj_parse parse;
+    parse.color_support = color_support;
+    parse.model = model;
+    parse.current_material = -1;
+    parse.unresolved_idx = UINT_MAX;
+
+    if (progress)
+    {
+        progress_lock(progress);
+        progress->model = model;
+        if (stream)
+            progress->bytes_total = decompress_stream_compressed_size(stream);
+        else
+        {
+            progress->bytes_total = file.size;
+            obj_sample_vertexes(progress, file.data, file.size);
+        }
+        progress_unlock(progress);
+    }
 
-    int current_material = -1;
+    // Progressive loads go part by part, otherwise the whole file is a single part.
+    const char *text = file.data;
+    const char *text_end = file.data + file.size;
+    size_t blocks_done = 0;
+    bool failed = false;
+    bool more = true;
 
-    // Check this is an ASCII STL file
-    // As the header of a binary STL could start with solid
-    // we must also check the second line starts with facet
-    bool is_ASCII = false;
+    while (more && !failed)
+    {
+        unsigned long long bytes_done;
 
-    // Check first line starts with "solid"
-    fgets(buffer, sizeof(buffer), fp);
+        if (stream)
+        {
+            // Compressed files are parsed block by block, while the rest is decompressed.
+            model->load_stats.file_bytes += obj_parse_stream(&parse, stream, blocks_done,
+                    progress ? threads_get_count() : 0, model);
+            blocks_done += parse.chunks_count;
+            more = progress && parse.chunks_count > 0;
+            bytes_done = decompress_stream_consumed(stream);
+        }
+        else
+        {
+            size_t size = text_end - text;
+            if (progress && size > OBJ_PROGRESSIVE_PART_SIZE)
+                size = scan_line_end(text + OBJ_PROGRESSIVE_PART_SIZE, text_end) - text;
 
-    char *bufferp = buffer;
-    char *instr = str_chop_skip_empty(&bufferp, " ");
+            int chunks_count = threads_get_count();
+            if (chunks_count > size / OBJ_MIN_CHUNK_SIZE)
+                chunks_count = size / OBJ_MIN_CHUNK_SIZE;
+            if (chunks_count < 1)
+                chunks_count = 1;
 
-    if (strcmp(instr, "solid") == 0)
-    {
-        // Check second line starts with "facet"
-        fgets(buffer, sizeof(buffer), fp);
+            parse.chunks_count = chunks_count;
+            parse.chunks = obj_split_chunks(text, size, chunks_count);
 
-        char *bufferp = buffer;
-        char *instr = str_chop_skip_empty(&bufferp, " ");
+            threads_run(chunks_count, obj_parse_chunk_job, &parse);
 
-        if (strcmp(instr, "facet") == 0)
+            text = (text + size < text_end) ? text + size + 1 : text_end;
+            more = text < text_end;
+            bytes_done = text - file.data;
+        }
+
+        failed = !obj_load_chunks(model, fname, &parse, progress, bytes_done);
+
+        if (progress && !progress->samples_ready)
         {
-            is_ASCII = true;
+            progress_lock(progress);
+            progress_sample_vertexes(progress, model->vertexes, model->vertex_count);
+            progress_unlock(progress);
         }
+        if (progress_cancelled(progress))
+            failed = true;
     }
 
-    if (is_ASCII)
+    if (stream && !failed)
+        failed = !decompress_stream_ok(stream);
+
+    progress_complete(progress);
+
+    if (!stream)
+        model->load_stats.file_bytes = file.size;
+    else
+        model->load_stats.compressed_bytes = decompress_stream_compressed_size(stream);
+    model->load_stats.parse_useconds = get_current_useconds() - start_time;
+
+    if (stream)
+        decompress_stream_close(stream);
+    mapped_file_close(&file);
+
+    if (failed)
     {
-        while (fgets(buffer, sizeof(buffer), fp))
-        {
-            string_strip(buffer);
+        model_free(model);
+        return NULL;
+    }
 
-            char *bufferp = buffer;
-            char *instr = str_chop_skip_empty(&bufferp, " ");
+    // Faces that use vertexes defined after them were triangularized without their positions
+    if (parse.unresolved_idx < model->vertex_count)
+    {
+        fprintf(stderr, "NOTE: Faces use vertexes defined after them, loading the model again.\n");
+        model_free(model);
+        return model_load_from_obj(fname, color_support, NULL);
+    }
 
-            // As we ignore normals only vertex definitions are required
-            if (strcmp(instr, "vertex") == 0)
-            {
-                float f1, f2, f3;
+    model_validate_idxs(model);
+    return model;
+}
 
-                if (!parse_float(&bufferp, &f1) || !parse_float(&bufferp, &f2) || !parse_float(&bufferp, &f3))
-                {
-                    fprintf(stderr, "ERROR: invalid \"vertex\" instruction.\n");
-                    fclose(fp);
-                    model_free(model);
-                    return NULL;
-                }
+// Minimum number of facets of a binary STL file for each decoding thread.
+#define STL_MIN_FACETS_PER_THREAD (1 << 16)
 
-                vec3 vec;
-                vec.x = f1;
-                vec.y = f3;
-                vec.z = f2;
+// Facets loaded at once, when loading a binary STL file progressively.
+#define STL_PROGRESSIVE_PART_FACETS (1 << 18)
 
-                model_add_vertex(model, vec);
-            }
+#define STL_HEADER_SIZE 80
+#define STL_FACET_SIZE 50
+
+struct stl_decode
+{
+    const char *facets;
+    unsigned int first_facet;
+    unsigned int facet_count;
+    int threads_count;
+    struct model *model;
+};
+
+// Decode a range of facets, 50 bytes each: facet normal, 3 vertices, and a 2 byte spacer.
+static void stl_decode_facets(void *data, int index)
+{
+    struct stl_decode *decode = data;
+    struct model *model = decode->model;
+
+    unsigned int begin = decode->first_facet
+        + (unsigned long long) decode->facet_count * index / decode->threads_count;
+    unsigned int end = decode->first_facet
+        + (unsigned long long) decode->facet_count * (index + 1) / decode->threads_count;
+
+    for (unsigned int i = begin; i < end; ++i)
+    {
+        float facet[12];
+        // NOTE: Assuming little-endian hardware.
+        memcpy(&facet, decode->facets + (size_t) i * STL_FACET_SIZE, sizeof(float[12]));
+
+        for (int v_index = 0; v_index < 3; v_index++)
+        {
+            vec3 *vec = &model->vertexes[3 * i + v_index];
+            vec->x = facet[3 + (v_index * 3)];
+            vec->y = facet[5 + (v_index * 3)];
+            vec->z = facet[4 + (v_index * 3)];
         }
+
+        struct face *face = &model->faces[i];
+        face->idxs[0] = 3 * i;
+        face->idxs[1] = 3 * i + 2;
+        face->idxs[2] = 3 * i + 1;
+        face->material = -1;
     }
-    else
+}
+
+static bool stl_load_binary(struct model *model, const struct mapped_file *file,
+        struct model_progress *progress)
+{
+    if (file->size < STL_HEADER_SIZE + sizeof(int))
+    {
+        fprintf(stderr, "ERROR: Failed to read facet count.\n");
+        return false;
+    }
+
+    unsigned int facet_count_expected;
+    // NOTE: Assuming little-endian hardware.
+    memcpy(&facet_count_expected, file->data + STL_HEADER_SIZE, sizeof(int));
+
+    // The facet count is given by the file size, the header is only used to warn about mismatches.
+    size_t facets_size = file->size - STL_HEADER_SIZE - sizeof(int);
+    if (facets_size % STL_FACET_SIZE != 0)
+    {
+        fprintf(stderr, "ERROR: Failed to read facet data.\n");
+        return false;
+    }
+    if (facets_size / STL_FACET_SIZE > UINT_MAX / 3)
+    {
+        fprintf(stderr, "ERROR: Too many facets.\n");
+        return false;
+    }
+    unsigned int facet_count_actual = facets_size / STL_FACET_SIZE;
+
+    if (facet_count_expected != facet_count_actual)
     {
-        // ASCII check will have moved the read pointer beyond the first block of data,
-        // reset to byte 80, after the 80 byte header
-        fseek(fp, 80, SEEK_SET);
+        fprintf(stderr, "WARN: imported facet count does not match expected facet count.\n");
+    }
+
+    model_reserve(model, 3 * facet_count_actual, facet_count_actual, false);
 
-        int facet_count_expected;
-        int facet_count_actual = 0;
+    struct stl_decode decode;
+    decode.facets = file->data + STL_HEADER_SIZE + sizeof(int);
+    decode.model = model;
 
-        char facet_count[4];
-        if (fread(facet_count, sizeof(int), 1, fp) != 1)
+    if (progress)
+    {
+        progress_lock(progress);
+        progress->model = model;
+        progress->bytes_total = file->size;
+        for (int k = 0; k < MODEL_PROGRESS_SAMPLES && k < facet_count_actual; ++k)
         {
-            fprintf(stderr, "ERROR: Failed to read facet count.\n");
-            fclose(fp);
-            model_free(model);
-            return NULL;
+            unsigned int i = (unsigned long long) facet_count_actual * k / MODEL_PROGRESS_SAMPLES;
+            float facet[12];
+            memcpy(&facet, decode.facets + (size_t) i * STL_FACET_SIZE, sizeof(float[12]));
+            progress->samples[k] = (vec3){facet[3], facet[5], facet[4]};
+            progress->samples_count = k + 1;
         }
-        // NOTE: Assuming little-endian hardware.
-        memcpy(&facet_count_expected, facet_count, sizeof(int));
+        progress->samples_ready = true;
+        progress_unlock(progress);
+    }
+
+    // Progressive loads go part by part, otherwise all the facets are decoded at once.
+    unsigned int part_size = progress ? STL_PROGRESSIVE_PART_FACETS : facet_count_actual;
 
-        // Read facet definitions, 50 bytes each, facet normal, 3 vertices, and a 2 byte spacer
-        char buffer[50];
-        size_t bytes_read;
-        while((bytes_read = fread(buffer, sizeof(char), 50, fp)))
+    for (unsigned int first = 0; first < facet_count_actual; first += part_size)
+    {
+        decode.first_facet = first;
+        decode.facet_count = facet_count_actual - first;
+        if (decode.facet_count > part_size)
+            decode.facet_count = part_size;
+
+        decode.threads_count = threads_get_count();
+        if (decode.threads_count > decode.facet_count / STL_MIN_FACETS_PER_THREAD)
+            decode.threads_count = decode.facet_count / STL_MIN_FACETS_PER_THREAD;
+        if (decode.threads_count < 1)
+            decode.threads_count = 1;
+
+        threads_run(decode.threads_count, stl_decode_facets, &decode);
+
+        progress_lock(progress);
+        model->vertex_count = 3 * (first + decode.facet_count);
+        model->faces_count = first + decode.facet_count;
+        if (progress)
         {
-            if (bytes_read < 50)
-            {
-                fprintf(stderr, "ERROR: Failed to read facet data.\n");
-                fclose(fp);
-                model_free(model);
-                return NULL;
-            }
+            progress_publish(progress, model, STL_HEADER_SIZE + sizeof(int)
+                    + (unsigned long long) model->faces_count * STL_FACET_SIZE);
+        }
+        progress_unlock(progress);
 
-            float facet[12];
-            memcpy(&facet, buffer, sizeof(float[12]));
+        if (progress_cancelled(progress))
+            return false;
+    }
+    return true;
+}
 
-            for (int v_index = 0; v_index < 3; v_index++)
-            {
-                vec3 vec;
-                vec.x = facet[3 + (v_index * 3)];
-                vec.y = facet[5 + (v_index * 3)];
-                vec.z = facet[4 + (v_index * 3)];
+static bool stl_load_ascii(struct model *model, const struct mapped_file *file)
+{
+    struct seg_array vertexes;
+    seg_array_init(&vertexes, sizeof(vec3));
 
-                model_add_vertex(model, vec);
-            }
+    const char *file_end = file->data + file->size;
+    const char *line_end;
 
-            ++facet_count_actual;
-        }
+    for (const char *line = file->data; line < file_end; line = line_end + 1)
+    {
+        line_end = scan_line_end(line, file_end);
+
+        struct scanner sc = {.p = line, .end = line_end};
+        const char *instr;
+        size_t instr_len = scan_token(&sc, &instr);
 
-        if (facet_count_expected != facet_count_actual)
+        // As we ignore normals only vertex definitions are required
+        if (scan_token_equals(instr, instr_len, "vertex"))
         {
-            fprintf(stderr, "WARN: imported facet count does not match expected facet count.\n");
+            float f1, f2, f3;
+
+            if (!scan_float(&sc, &f1) || !scan_float(&sc, &f2) || !scan_float(&sc, &f3))
+            {
+                fprintf(stderr, "ERROR: invalid \"vertex\" instruction.\n");
+                seg_array_free(&vertexes);
+                return false;
+            }
+
+            vec3 *vec = seg_array_push(&vertexes);
+            vec->x = f1;
+            vec->y = f3;
+            vec->z = f2;
         }
     }
 
+    model_reserve(model, vertexes.count, (vertexes.count + 2) / 3, false);
+    seg_array_copy_to(&vertexes, model->vertexes);
+    model->vertex_count = vertexes.count;
+    model->load_stats.allocations += vertexes.allocations;
+    seg_array_free(&vertexes);
+
     // For every 3 vertices create a face
-    for (int i = 0; i < model->vertex_count; i += 3)
+    for (unsigned int i = 0; i < model->vertex_count; i += 3)
     {
-        model_add_face(model, i, i + 2, i + 1, current_material);
+        model_add_face(model, i, i + 2, i + 1, -1);
     }
+    return true;
+}
 
-    fclose(fp);
+// Check this is an ASCII STL file
+// As the header of a binary STL could start with solid
+// we must also check the second line starts with facet
+static bool stl_is_ascii(const struct mapped_file *file)
+{
+    const char *file_end = file->data + file->size;
 
-    model_validate_idxs(model);
-    return model;
+    // Check first line starts with "solid"
+    struct scanner sc = {.p = file->data, .end = scan_line_end(file->data, file_end)};
+    const char *instr;
+    size_t instr_len = scan_token(&sc, &instr);
+
+    if (!scan_token_equals(instr, instr_len, "solid") || sc.end == file_end)
+        return false;
+
+    // Check second line starts with "facet"
+    sc.p = sc.end + 1;
+    sc.end = scan_line_end(sc.p, file_end);
+    instr_len = scan_token(&sc, &instr);
+
+    return scan_token_equals(instr, instr_len, "facet");
+}
+
+// Contents of an input file, mapped or decompressed in memory.
+struct model_input
+{
+    struct mapped_file file;
+    char *decompressed;
+    size_t compressed_size;
+};
+
+// Open the whole file for random access, compressed files are fully decompressed first.
+static bool model_input_open(struct model_input *input, const char *fname)
+{
+    enum compression compression = compression_from_filename(fname);
+
+    input->decompressed = NULL;
+    input->compressed_size = 0;
+
+    if (compression != COMPRESSION_NONE)
+    {
+        size_t size;
+        if (!decompress_file(fname, compression, &input->decompressed, &size, &input->compressed_size))
+            return false;
+        input->file.data = input->decompressed;
+        input->file.size = size;
+    }
+    else if (!mapped_file_open(&input->file, fname, false))
+    {
+        fprintf(stderr, "ERROR: failed to load file \"%s\".\n", fname);
+        return false;
+    }
+    return true;
+}
+
+static void model_input_close(struct model_input *input, struct model *model)
+{
+    model->load_stats.file_bytes = input->file.size;
+    model->load_stats.compressed_bytes = input->compressed_size;
+
+    if (input->decompressed)
+    {
+        free(input->decompressed);
+        model->load_stats.allocations++;
+    }
+    else
+        mapped_file_close(&input->file);
+}
+
+struct model *model_load_from_stl(const char *fname, struct model_progress *progress)
+{
+    unsigned long long start_time = get_current_useconds();
+
+    struct model_input input;
+    if (!model_input_open(&input, fname))
+        return NULL;
+    const struct mapped_file file = input.file;
+
+    // Create a new model
+    struct model *model = model_init();
+
+    bool loaded;
+    if (stl_is_ascii(&file))
+        loaded = stl_load_ascii(model, &file);
+    else
+        loaded = stl_load_binary(model, &file, progress);
+
+    progress_complete(progress);
+
+    model->load_stats.parse_useconds = get_current_useconds() - start_time;
+
+    model_input_close(&input, model);
+
+    if (!loaded)
+    {
+        model_free(model);
+        return NULL;
+    }
+
+    model_validate_idxs(model);
+    return model;
+}
+
+#define PLY_MAX_ELEMENTS 16
+#define PLY_MAX_PROPERTIES 32
+#define PLY_SCRATCH_BLOCK_SIZE (1 << 12)
+
+enum ply_type
+{
+    PLY_NONE,
+    PLY_INT8,
+    PLY_UINT8,
+    PLY_INT16,
+    PLY_UINT16,
+    PLY_INT32,
+    PLY_UINT32,
+    PLY_FLOAT32,
+    PLY_FLOAT64,
+};
+
+static const int PLY_TYPE_SIZES[] = {0, 1, 1, 2, 2, 4, 4, 4, 8};
+
+struct ply_property
+{
+    const char *name;
+    size_t name_len;
+    enum ply_type type;
+    // Type of the number of items, PLY_NONE if the property is not a list.
+    enum ply_type count_type;
+};
+
+struct ply_element
+{
+    const char *name;
+    size_t name_len;
+    unsigned long long count;
+    int properties_count;
+    struct ply_property properties[PLY_MAX_PROPERTIES];
+};
+
+struct ply_header
+{
+    bool ascii;
+    int elements_count;
+    struct ply_element elements[PLY_MAX_ELEMENTS];
+    // Start of the element data, after the header.
+    const char *data;
+};
+
+// Reads the values of the elements, from binary or ASCII data.
+struct ply_reader
+{
+    bool ascii;
+    bool failed;
+    const char *p;
+    const char *end;
+};
+
+static enum ply_type ply_parse_type(const char *tok, size_t len)
+{
+    static const struct
+    {
+        const char *name;
+        enum ply_type type;
+    } names[] = {
+        {"char", PLY_INT8}, {"int8", PLY_INT8}, {"uchar", PLY_UINT8}, {"uint8", PLY_UINT8},
+        {"short", PLY_INT16}, {"int16", PLY_INT16}, {"ushort", PLY_UINT16}, {"uint16", PLY_UINT16},
+        {"int", PLY_INT32}, {"int32", PLY_INT32}, {"uint", PLY_UINT32}, {"uint32", PLY_UINT32},
+        {"float", PLY_FLOAT32}, {"float32", PLY_FLOAT32}, {"double", PLY_FLOAT64},
+        {"float64", PLY_FLOAT64},
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    {
+        if (scan_token_equals(tok, len, names[i].name))
+            return names[i].type;
+    }
+    return PLY_NONE;
+}
+
+static bool ply_parse_header(struct ply_header *header, const struct mapped_file *file)
+{
+    const char *file_end = file->data + file->size;
+    const char *line = file->data;
+    const char *line_end = scan_line_end(line, file_end);
+
+    struct scanner magic = {.p = line, .end = line_end};
+    const char *tok;
+    size_t len = scan_token(&magic, &tok);
+    if (!scan_token_equals(tok, len, "ply"))
+    {
+        fprintf(stderr, "ERROR: Not a PLY file.\n");
+        return false;
+    }
+
+    header->elements_count = 0;
+    bool has_format = false;
+
+    for (line = line_end + 1; line < file_end; line = line_end + 1)
+    {
+        line_end = scan_line_end(line, file_end);
+
+        struct scanner sc = {.p = line, .end = line_end};
+        const char *instr;
+        size_t instr_len = scan_token(&sc, &instr);
+
+        if (scan_token_equals(instr, instr_len, "end_header"))
+        {
+            if (!has_format)
+            {
+                fprintf(stderr, "ERROR: PLY header has no format.\n");
+                return false;
+            }
+            header->data = (line_end < file_end) ? line_end + 1 : file_end;
+            return true;
+        }
+        else if (scan_token_equals(instr, instr_len, "format"))
+        {
+            len = scan_token(&sc, &tok);
+            if (scan_token_equals(tok, len, "ascii"))
+                header->ascii = true;
+            else if (scan_token_equals(tok, len, "binary_little_endian"))
+                header->ascii = false;
+            else
+            {
+                fprintf(stderr, "ERROR: Unsupported PLY format \"%.*s\".\n", (int) len, tok);
+                return false;
+            }
+            has_format = true;
+        }
+        else if (scan_token_equals(instr, instr_len, "element"))
+        {
+            if (header->elements_count == PLY_MAX_ELEMENTS)
+            {
+                fprintf(stderr, "ERROR: Too many PLY elements.\n");
+                return false;
+            }
+            struct ply_element *element = &header->elements[header->elements_count++];
+            element->name_len = scan_token(&sc, &element->name);
+
+            len = scan_token(&sc, &tok);
+            unsigned long long count = 0;
+            bool valid = len > 0;
+            for (size_t i = 0; i < len && valid; ++i)
+            {
+                valid = tok[i] >= '0' && tok[i] <= '9' && count <= UINT_MAX;
+                count = 10 * count + (tok[i] - '0');
+            }
+            if (!valid)
+            {
+                fprintf(stderr, "ERROR: invalid PLY \"element\" instruction.\n");
+                return false;
+            }
+            element->count = count;
+            element->properties_count = 0;
+        }
+        else if (scan_token_equals(instr, instr_len, "property"))
+        {
+            if (header->elements_count == 0)
+            {
+                fprintf(stderr, "ERROR: PLY property without element.\n");
+                return false;
+            }
+            struct ply_element *element = &header->elements[header->elements_count - 1];
+            if (element->properties_count == PLY_MAX_PROPERTIES)
+            {
+                fprintf(stderr, "ERROR: Too many PLY properties.\n");
+                return false;
+            }
+            struct ply_property *property = &element->properties[element->properties_count++];
+
+            len = scan_token(&sc, &tok);
+            property->count_type = PLY_NONE;
+            if (scan_token_equals(tok, len, "list"))
+            {
+                len = scan_token(&sc, &tok);
+                property->count_type = ply_parse_type(tok, len);
+                len = scan_token(&sc, &tok);
+                if (property->count_type == PLY_NONE || property->count_type >= PLY_FLOAT32)
+                {
+                    fprintf(stderr, "ERROR: invalid PLY \"property\" instruction.\n");
+                    return false;
+                }
+            }
+            property->type = ply_parse_type(tok, len);
+            property->name_len = scan_token(&sc, &property->name);
+
+            if (property->type == PLY_NONE || property->name_len == 0)
+            {
+                fprintf(stderr, "ERROR: invalid PLY \"property\" instruction.\n");
+                return false;
+            }
+        }
+    }
+
+    fprintf(stderr, "ERROR: PLY header has no end.\n");
+    return false;
+}
+
+static double ply_read(struct ply_reader *reader, enum ply_type type)
+{
+    if (reader->ascii)
+    {
+        const char *p = reader->p;
+        while (p < reader->end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            p++;
+        const char *tok = p;
+        while (p < reader->end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+            p++;
+        reader->p = p;
+
+        if (tok == p)
+        {
+            reader->failed = true;
+            return 0;
+        }
+        if (type >= PLY_FLOAT32)
+            return scan_parse_float(tok, p);
+        return scan_parse_int(tok, p);
+    }
+
+    int size = PLY_TYPE_SIZES[type];
+    if (reader->end - reader->p < size)
+    {
+        reader->failed = true;
+        return 0;
+    }
+
+    union
+    {
+        int8_t i8;
+        uint8_t u8;
+        int16_t i16;
+        uint16_t u16;
+        int32_t i32;
+        uint32_t u32;
+        float f32;
+        double f64;
+    } value;
+
+    // NOTE: Assuming little-endian hardware.
+    memcpy(&value, reader->p, size);
+    reader->p += size;
+
+    switch (type)
+    {
+        case PLY_INT8:
+            return value.i8;
+        case PLY_UINT8:
+            return value.u8;
+        case PLY_INT16:
+            return value.i16;
+        case PLY_UINT16:
+            return value.u16;
+        case PLY_INT32:
+            return value.i32;
+        case PLY_UINT32:
+            return value.u32;
+        case PLY_FLOAT32:
+            return value.f32;
+        case PLY_FLOAT64:
+            return value.f64;
+        default:
+            return 0;
+    }
+}
+
+// Index of the property with the given name, -1 if the element doesn't have it.
+static int ply_find_property(const struct ply_element *element, const char *name)
+{
+    for (int i = 0; i < element->properties_count; ++i)
+    {
+        if (scan_token_equals(element->properties[i].name, element->properties[i].name_len, name))
+            return i;
+    }
+    return -1;
+}
+
+static bool ply_element_is(const struct ply_element *element, const char *name)
+{
+    return scan_token_equals(element->name, element->name_len, name);
+}
+
+// Bytes of a binary record of the element, 0 if it has lists.
+static size_t ply_record_size(const struct ply_element *element)
+{
+    size_t size = 0;
+    for (int i = 0; i < element->properties_count; ++i)
+    {
+        if (element->properties[i].count_type != PLY_NONE)
+            return 0;
+        size += PLY_TYPE_SIZES[element->properties[i].type];
+    }
+    return size;
+}
+
+// Read the count of a list property, failing if it is not a count or the file is too short for its
+// items.
+static unsigned int ply_read_count(struct ply_reader *reader, const struct ply_property *property)
+{
+    // ASCII counts are read as floats, to see if they are whole and in range
+    double count = ply_read(reader, reader->ascii ? PLY_FLOAT64 : property->count_type);
+    if (reader->failed)
+        return 0;
+
+    // An ASCII item takes a digit and a space at least
+    size_t min_item_size = reader->ascii ? 2 : PLY_TYPE_SIZES[property->type];
+    if (!(count >= 0 && count <= UINT_MAX) || count != (unsigned int) count
+            || (unsigned int) count > (reader->end - reader->p) / min_item_size)
+    {
+        reader->failed = true;
+        return 0;
+    }
+    return count;
+}
+
+// Read a whole record, keeping the values of the scalar properties and the items of the list
+// property list_idx (that are stored in the scratch arena).
+static void ply_read_record(struct ply_reader *reader, const struct ply_element *element,
+        double *values, int list_idx, unsigned int **list, unsigned int *list_count,
+        struct arena *scratch)
+{
+    for (int i = 0; i < element->properties_count && !reader->failed; ++i)
+    {
+        const struct ply_property *property = &element->properties[i];
+
+        if (property->count_type == PLY_NONE)
+        {
+            values[i] = ply_read(reader, property->type);
+            continue;
+        }
+
+        unsigned int count = ply_read_count(reader, property);
+        if (reader->failed)
+            break;
+
+        if (i == list_idx)
+        {
+            *list = arena_alloc(scratch, count * sizeof(unsigned int));
+            *list_count = count;
+            for (unsigned int k = 0; k < count; ++k)
+                (*list)[k] = ply_read(reader, property->type);
+        }
+        else if (!reader->ascii)
+        {
+            reader->p += (size_t) count * PLY_TYPE_SIZES[property->type];
+        }
+        else
+        {
+            for (unsigned int k = 0; k < count; ++k)
+                ply_read(reader, property->type);
+        }
+    }
+}
+
+static bool ply_load_vertexes(struct model *model, struct ply_reader *reader,
+        const struct ply_element *element)
+{
+    int x_idx = ply_find_property(element, "x");
+    int y_idx = ply_find_property(element, "y");
+    int z_idx = ply_find_property(element, "z");
+
+    if (x_idx < 0 || y_idx < 0 || z_idx < 0)
+    {
+        fprintf(stderr, "ERROR: PLY vertexes have no \"x\", \"y\" and \"z\" properties.\n");
+        return false;
+    }
+
+    // Don't trust the count before reserving, in case the file is truncated
+    size_t record_size = ply_record_size(element);
+    size_t min_record_size = reader->ascii ? 2 * element->properties_count : (record_size ? record_size : 1);
+    if (element->count > UINT_MAX - model->vertex_count
+            || element->count > (reader->end - reader->p) / min_record_size)
+    {
+        fprintf(stderr, "ERROR: PLY file is too short for its vertexes.\n");
+        return false;
+    }
+    unsigned int count = element->count;
+
+    model_reserve(model, count, 0, false);
+    vec3 *vertexes = &model->vertexes[model->vertex_count];
+
+    // Fast path: the vertexes are already laid out as vec3 in the file.
+    if (!reader->ascii && element->properties_count == 3 && x_idx == 0 && y_idx == 1 && z_idx == 2
+            && element->properties[0].type == PLY_FLOAT32 && element->properties[1].type == PLY_FLOAT32
+            && element->properties[2].type == PLY_FLOAT32)
+    {
+        // NOTE: Assuming little-endian hardware.
+        memcpy(vertexes, reader->p, (size_t) count * sizeof(vec3));
+        reader->p += (size_t) count * sizeof(vec3);
+        model->vertex_count += count;
+        return true;
+    }
+
+    double values[PLY_MAX_PROPERTIES];
+
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        ply_read_record(reader, element, values, -1, NULL, NULL, NULL);
+        vertexes[i].x = values[x_idx];
+        vertexes[i].y = values[y_idx];
+        vertexes[i].z = values[z_idx];
+    }
+
+    if (reader->failed)
+    {
+        fprintf(stderr, "ERROR: Failed to read PLY vertexes.\n");
+        return false;
+    }
+    model->vertex_count += count;
+    return true;
+}
+
+static void ply_add_polygon(struct model *model, const unsigned int *idxs, unsigned int idx_count,
+        struct arena *scratch)
+{
+    if (idx_count < 3)
+    {
+        fprintf(stderr, "WARN: PLY face with less than 3 vertexes.\n");
+        return;
+    }
+
+    vec3 *vecs = arena_alloc(scratch, idx_count * sizeof(vec3));
+    for (unsigned int i = 0; i < idx_count; ++i)
+    {
+        // Invalid indexes are reported and fixed later by model_validate_idxs.
+        if (idxs[i] < model->vertex_count)
+            vecs[i] = model->vertexes[idxs[i]];
+        else
+            vecs[i] = (vec3){0, 0, 0};
+    }
+
+    int *triangle_idxs = arena_alloc(scratch, (idx_count - 2) * 3 * sizeof(int));
+
+    triangularize(vecs, idx_count, triangle_idxs, scratch);
+
+    for (unsigned int i = 0; i < idx_count - 2; ++i)
+    {
+        model_add_face(model, idxs[triangle_idxs[3 * i]], idxs[triangle_idxs[3 * i + 1]],
+                idxs[triangle_idxs[3 * i + 2]], -1);
+    }
+}
+
+static bool ply_load_faces(struct model *model, struct ply_reader *reader,
+        const struct ply_element *element, struct arena *scratch)
+{
+    int list_idx = ply_find_property(element, "vertex_indices");
+    if (list_idx < 0)
+        list_idx = ply_find_property(element, "vertex_index");
+
+    if (list_idx < 0 || element->properties[list_idx].count_type == PLY_NONE)
+    {
+        fprintf(stderr, "ERROR: PLY faces have no \"vertex_indices\" list property.\n");
+        return false;
+    }
+    const struct ply_property *list = &element->properties[list_idx];
+
+    // Don't trust the count before reserving, in case the file is truncated
+    if (element->count > UINT_MAX - model->faces_count
+            || element->count > (reader->end - reader->p) / (reader->ascii ? 2 : 1))
+    {
+        fprintf(stderr, "ERROR: PLY file is too short for its faces.\n");
+        return false;
+    }
+    unsigned int count = element->count;
+
+    model_reserve(model, 0, count, false);
+
+    double values[PLY_MAX_PROPERTIES];
+
+    // Fast path: the only property is the list, with a byte count and 4 byte indexes.
+    bool fast = !reader->ascii && element->properties_count == 1 && list->count_type == PLY_UINT8
+        && (list->type == PLY_INT32 || list->type == PLY_UINT32);
+
+    for (unsigned int f = 0; f < count && !reader->failed; ++f)
+    {
+        if (fast && reader->end - reader->p >= 13 && reader->p[0] == 3)
+        {
+            uint32_t idxs[3];
+            // NOTE: Assuming little-endian hardware.
+            memcpy(idxs, reader->p + 1, sizeof(idxs));
+            reader->p += 13;
+            model_add_face(model, idxs[0], idxs[1], idxs[2], -1);
+            continue;
+        }
+
+        arena_reset(scratch);
+
+        unsigned int *idxs = NULL;
+        unsigned int idx_count = 0;
+        ply_read_record(reader, element, values, list_idx, &idxs, &idx_count, scratch);
+
+        if (!reader->failed)
+            ply_add_polygon(model, idxs, idx_count, scratch);
+    }
+
+    if (reader->failed)
+    {
+        fprintf(stderr, "ERROR: Failed to read PLY faces.\n");
+        return false;
+    }
+    return true;
+}
+
+// Skip the records of an element that is not used.
+static void ply_skip_element(struct ply_reader *reader, const struct ply_element *element)
+{
+    size_t record_size = ply_record_size(element);
+
+    if (!reader->ascii && record_size > 0)
+    {
+        if (element->count > (reader->end - reader->p) / record_size)
+            reader->failed = true;
+        else
+            reader->p += element->count * record_size;
+        return;
+    }
+
+    double values[PLY_MAX_PROPERTIES];
+    for (unsigned long long i = 0; i < element->count && !reader->failed; ++i)
+        ply_read_record(reader, element, values, -1, NULL, NULL, NULL);
+}
+
+struct model *model_load_from_ply(const char *fname)
+{
+    unsigned long long start_time = get_current_useconds();
+
+    struct model_input input;
+    if (!model_input_open(&input, fname))
+        return NULL;
+
+    // Create a new model
+    struct model *model = model_init();
+
+    struct ply_header header;
+    bool loaded = ply_parse_header(&header, &input.file);
+
+    if (loaded)
+    {
+        struct ply_reader reader;
+        reader.ascii = header.ascii;
+        reader.failed = false;
+        reader.p = header.data;
+        reader.end = input.file.data + input.file.size;
+
+        struct arena scratch;
+        arena_init(&scratch, PLY_SCRATCH_BLOCK_SIZE);
+
+        for (int e = 0; e < header.elements_count && loaded; ++e)
+        {
+            const struct ply_element *element = &header.elements[e];
+
+            if (ply_element_is(element, "vertex"))
+                loaded = ply_load_vertexes(model, &reader, element);
+            else if (ply_element_is(element, "face"))
+                loaded = ply_load_faces(model, &reader, element, &scratch);
+            else
+                ply_skip_element(&reader, element);
+
+            if (loaded && reader.failed)
+            {
+                fprintf(stderr, "ERROR: Failed to read PLY element \"%.*s\".\n",
+                        (int) element->name_len, element->name);
+                loaded = false;
+            }
+        }
+
+        model->load_stats.allocations += scratch.allocations;
+        arena_free(&scratch);
+    }
+
+    model->load_stats.parse_useconds = get_current_useconds() - start_time;
+
+    model_input_close(&input, model);
+
+    if (!loaded)
+    {
+        model_free(model);
+        return NULL;
+    }
+
+    model_validate_idxs(model);
+    return model;
+}
+
+#define GLB_MAGIC 0x46546C67 // "glTF"
+#define GLB_VERSION 2
+#define GLB_HEADER_SIZE 12
+#define GLB_CHUNK_HEADER_SIZE 8
+#define GLB_CHUNK_JSON 0x4E4F534A
+#define GLB_CHUNK_BIN 0x004E4942
+#define GLB_JSON_BLOCK_SIZE 65536
+#define GLB_MAX_NODE_DEPTH 64
+
+#define GLTF_UNSIGNED_BYTE 5121
+#define GLTF_UNSIGNED_SHORT 5123
+#define GLTF_UNSIGNED_INT 5125
+#define GLTF_FLOAT 5126
+
+#define GLTF_MODE_TRIANGLES 4
+#define GLTF_MODE_TRIANGLE_STRIP 5
+#define GLTF_MODE_TRIANGLE_FAN 6
+
+struct glb_file
+{
+    const struct json_value *json;
+    const char *bin;
+    size_t bin_size;
+
+    // Model material of each glTF material, NULL without color support.
+    int *materials;
+    size_t materials_count;
+};
+
+// Elements of an accessor, resolved to the position of the data in the BIN chunk.
+struct glb_accessor
+{
+    const char *data;
+    size_t count;
+    size_t stride;
+    int component_type;
+    int components;
+};
+
+static uint32_t glb_read_u32(const char *p)
+{
+    uint32_t val;
+    // NOTE: Assuming little-endian hardware.
+    memcpy(&val, p, sizeof(val));
+    return val;
+}
+
+// Item of a top-level array of the glTF JSON referenced by an index value, NULL if invalid.
+static const struct json_value *glb_item(const struct glb_file *glb, const char *array,
+        const struct json_value *index)
+{
+    const struct json_value *items = json_get(glb->json, array);
+    double i = json_number(index, -1);
+    if (!items || i < 0 || i >= items->count)
+        return NULL;
+    return json_at(items, (size_t) i);
+}
+
+static bool glb_parse_chunks(struct glb_file *glb, const struct mapped_file *file, struct arena *arena)
+{
+    if (file->size < GLB_HEADER_SIZE || glb_read_u32(file->data) != GLB_MAGIC)
+    {
+        fprintf(stderr, "ERROR: Not a GLB file.\n");
+        return false;
+    }
+    if (glb_read_u32(file->data + 4) != GLB_VERSION)
+    {
+        fprintf(stderr, "ERROR: Only version 2 of GLB files is supported.\n");
+        return false;
+    }
+
+    const char *json_data = NULL;
+    size_t json_size = 0;
+    glb->bin = NULL;
+    glb->bin_size = 0;
+
+    // The first chunk is the JSON, optionally followed by the BIN chunk.
+    size_t pos = GLB_HEADER_SIZE;
+    while (file->size - pos >= GLB_CHUNK_HEADER_SIZE)
+    {
+        size_t size = glb_read_u32(file->data + pos);
+        uint32_t type = glb_read_u32(file->data + pos + 4);
+        pos += GLB_CHUNK_HEADER_SIZE;
+
+        if (size > file->size - pos)
+        {
+            fprintf(stderr, "ERROR: GLB chunk exceeds the file size.\n");
+            return false;
+        }
+        if (type == GLB_CHUNK_JSON && !json_data)
+        {
+            json_data = file->data + pos;
+            json_size = size;
+        }
+        else if (type == GLB_CHUNK_BIN && !glb->bin)
+        {
+            glb->bin = file->data + pos;
+            glb->bin_size = size;
+        }
+        pos += size;
+    }
+
+    if (!json_data)
+    {
+        fprintf(stderr, "ERROR: GLB file without JSON chunk.\n");
+        return false;
+    }
+    if (!(glb->json = json_parse(json_data, json_size, arena)) || glb->json->type != JSON_OBJECT)
+    {
+        fprintf(stderr, "ERROR: Invalid JSON chunk in GLB file.\n");
+        return false;
+    }
+    return true;
+}
+
+static bool glb_get_accessor(const struct glb_file *glb, const struct json_value *index,
+        struct glb_accessor *accessor)
+{
+    const struct json_value *acc = glb_item(glb, "accessors", index);
+    if (!acc)
+    {
+        fprintf(stderr, "ERROR: Invalid glTF accessor.\n");
+        return false;
+    }
+    if (json_get(acc, "sparse"))
+    {
+        fprintf(stderr, "ERROR: Sparse glTF accessors are not supported.\n");
+        return false;
+    }
+
+    const struct json_value *view = glb_item(glb, "bufferViews", json_get(acc, "bufferView"));
+    if (!view)
+    {
+        fprintf(stderr, "ERROR: glTF accessor without buffer view.\n");
+        return false;
+    }
+
+    // Only the buffer stored in the BIN chunk can be used, it's always the first one.
+    const struct json_value *buffer = glb_item(glb, "buffers", json_get(view, "buffer"));
+    if (!buffer || json_number(json_get(view, "buffer"), -1) != 0 || json_get(buffer, "uri") || !glb->bin)
+    {
+        fprintf(stderr, "ERROR: External glTF buffers are not supported.\n");
+        return false;
+    }
+
+    const struct json_value *type = json_get(acc, "type");
+    if (json_string_equals(type, "SCALAR"))
+        accessor->components = 1;
+    else if (json_string_equals(type, "VEC3"))
+        accessor->components = 3;
+    else
+        accessor->components = 0; // Not used by the loader.
+
+    double component_type = json_number(json_get(acc, "componentType"), 0);
+    size_t component_size = 0;
+    if (component_type == GLTF_UNSIGNED_BYTE)
+        component_size = 1;
+    else if (component_type == GLTF_UNSIGNED_SHORT)
+        component_size = 2;
+    else if (component_type == GLTF_UNSIGNED_INT || component_type == GLTF_FLOAT)
+        component_size = 4;
+    size_t element_size = component_size * accessor->components;
+
+    // Checked as doubles, before converting them, so invalid numbers can't overflow.
+    double count = json_number(json_get(acc, "count"), -1);
+    double offset = json_number(json_get(acc, "byteOffset"), 0);
+    double view_offset = json_number(json_get(view, "byteOffset"), 0);
+    double view_length = json_number(json_get(view, "byteLength"), -1);
+    double stride = json_number(json_get(view, "byteStride"), element_size);
+
+    if (element_size == 0 || count < 0 || offset < 0 || view_offset < 0 || view_length < 0 ||
+            view_offset + view_length > glb->bin_size || stride < element_size ||
+            (count > 0 && offset + (count - 1) * stride + element_size > view_length))
+    {
+        fprintf(stderr, "ERROR: Invalid glTF accessor.\n");
+        return false;
+    }
+
+    accessor->component_type = component_type;
+    accessor->count = count;
+    accessor->stride = stride;
+    accessor->data = glb->bin + (size_t) view_offset + (size_t) offset;
+    return true;
+}
+
+static void glb_matrix_multiply(float *res, const float *a, const float *b)
+{
+    // Column-major, as in glTF.
+    for (int c = 0; c < 4; ++c)
+    {
+        for (int r = 0; r < 4; ++r)
+        {
+            res[c * 4 + r] = 0;
+            for (int k = 0; k < 4; ++k)
+                res[c * 4 + r] += a[k * 4 + r] * b[c * 4 + k];
+        }
+    }
+}
+
+static const float GLB_IDENTITY[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+
+// Local transformation of a node, from its matrix or its translation, rotation and scale.
+static void glb_node_matrix(const struct json_value *node, float *m)
+{
+    const struct json_value *matrix = json_get(node, "matrix");
+    if (matrix)
+    {
+        for (int i = 0; i < 16; ++i)
+            m[i] = json_number(json_at(matrix, i), GLB_IDENTITY[i]);
+        return;
+    }
+
+    const struct json_value *t = json_get(node, "translation");
+    const struct json_value *r = json_get(node, "rotation");
+    const struct json_value *s = json_get(node, "scale");
+
+    float qx = json_number(json_at(r, 0), 0);
+    float qy = json_number(json_at(r, 1), 0);
+    float qz = json_number(json_at(r, 2), 0);
+    float qw = json_number(json_at(r, 3), 1);
+    float sx = json_number(json_at(s, 0), 1);
+    float sy = json_number(json_at(s, 1), 1);
+    float sz = json_number(json_at(s, 2), 1);
+
+    // T * R * S
+    m[0] = (1 - 2 * (qy * qy + qz * qz)) * sx;
+    m[1] = 2 * (qx * qy + qz * qw) * sx;
+    m[2] = 2 * (qx * qz - qy * qw) * sx;
+    m[3] = 0;
+    m[4] = 2 * (qx * qy - qz * qw) * sy;
+    m[5] = (1 - 2 * (qx * qx + qz * qz)) * sy;
+    m[6] = 2 * (qy * qz + qx * qw) * sy;
+    m[7] = 0;
+    m[8] = 2 * (qx * qz + qy * qw) * sz;
+    m[9] = 2 * (qy * qz - qx * qw) * sz;
+    m[10] = (1 - 2 * (qx * qx + qy * qy)) * sz;
+    m[11] = 0;
+    m[12] = json_number(json_at(t, 0), 0);
+    m[13] = json_number(json_at(t, 1), 0);
+    m[14] = json_number(json_at(t, 2), 0);
+    m[15] = 1;
+}
+
+static bool glb_load_positions(struct model *model, const struct glb_accessor *accessor,
+        const float *m)
+{
+    if (accessor->component_type != GLTF_FLOAT || accessor->components != 3)
+    {
+        fprintf(stderr, "ERROR: glTF positions must be float 3D vectors.\n");
+        return false;
+    }
+    if (accessor->count > UINT_MAX - model->vertex_count)
+    {
+        fprintf(stderr, "ERROR: Too many vertexes in GLB file.\n");
+        return false;
+    }
+
+    model_reserve(model, accessor->count, 0, true);
+    vec3 *dst = model->vertexes + model->vertex_count;
+
+    // NOTE: Assuming little-endian hardware.
+    if (accessor->stride == sizeof(vec3) && memcmp(m, GLB_IDENTITY, sizeof(GLB_IDENTITY)) == 0)
+        memcpy(dst, accessor->data, accessor->count * sizeof(vec3));
+    else
+    {
+        for (size_t i = 0; i < accessor->count; ++i)
+        {
+            vec3 v;
+            memcpy(&v, accessor->data + i * accessor->stride, sizeof(v));
+            dst[i].x = m[0] * v.x + m[4] * v.y + m[8] * v.z + m[12];
+            dst[i].y = m[1] * v.x + m[5] * v.y + m[9] * v.z + m[13];
+            dst[i].z = m[2] * v.x + m[6] * v.y + m[10] * v.z + m[14];
+        }
+    }
+    model->vertex_count += accessor->count;
+    return true;
+}
+
+// Read the indexes of a primitive relative to the model, out of range ones are replaced with
+// UINT_MAX so they are reported by model_validate_idxs.
+static bool glb_load_indexes(const struct glb_accessor *accessor, unsigned int *idxs,
+        unsigned int base, unsigned int vertex_count)
+{
+    if (accessor->components != 1)
+    {
+        fprintf(stderr, "ERROR: glTF indexes must be scalars.\n");
+        return false;
+    }
+
+    for (size_t i = 0; i < accessor->count; ++i)
+    {
+        const char *p = accessor->data + i * accessor->stride;
+        uint32_t idx;
+        if (accessor->component_type == GLTF_UNSIGNED_BYTE)
+            idx = *(const uint8_t *) p;
+        else if (accessor->component_type == GLTF_UNSIGNED_SHORT)
+        {
+            uint16_t val;
+            // NOTE: Assuming little-endian hardware.
+            memcpy(&val, p, sizeof(val));
+            idx = val;
+        }
+        else if (accessor->component_type == GLTF_UNSIGNED_INT)
+            idx = glb_read_u32(p);
+        else
+        {
+            fprintf(stderr, "ERROR: Invalid type of glTF indexes.\n");
+            return false;
+        }
+        idxs[i] = idx < vertex_count ? base + idx : UINT_MAX;
+    }
+    return true;
+}
+
+static bool glb_load_primitive(struct model *model, const struct glb_file *glb,
+        const struct json_value *primitive, const float *m, bool flip)
+{
+    double mode = json_number(json_get(primitive, "mode"), GLTF_MODE_TRIANGLES);
+    if (mode != GLTF_MODE_TRIANGLES && mode != GLTF_MODE_TRIANGLE_STRIP && mode != GLTF_MODE_TRIANGLE_FAN)
+        return true; // Points and lines are not drawn.
+
+    const struct json_value *position = json_get(json_get(primitive, "attributes"), "POSITION");
+    if (!position)
+        return true;
+
+    struct glb_accessor positions;
+    if (!glb_get_accessor(glb, position, &positions))
+        return false;
+
+    unsigned int base = model->vertex_count;
+    if (!glb_load_positions(model, &positions, m))
+        return false;
+
+    // Indexes, or the vertexes in order for non-indexed primitives.
+    struct glb_accessor indexes;
+    const struct json_value *indexes_index = json_get(primitive, "indices");
+    if (indexes_index && !glb_get_accessor(glb, indexes_index, &indexes))
+        return false;
+    size_t idx_count = indexes_index ? indexes.count : positions.count;
+
+    // An empty primitive keeps the indexes NULL, it has no triangles to read.
+    unsigned int *idxs = NULL;
+    if (idx_count > 0)
+    {
+        if (!(idxs = malloc(idx_count * sizeof(*idxs))))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+        model->load_stats.allocations++;
+    }
+
+    bool loaded = true;
+    if (indexes_index)
+        loaded = glb_load_indexes(&indexes, idxs, base, positions.count);
+    else
+    {
+        for (size_t i = 0; i < idx_count; ++i)
+            idxs[i] = base + i;
+    }
+
+    int material = -1;
+    if (glb->materials)
+    {
+        double index = json_number(json_get(primitive, "material"), -1);
+        if (index >= 0 && index < glb->materials_count)
+            material = glb->materials[(size_t) index];
+    }
+
+    if (loaded)
+    {
+        size_t triangles = mode == GLTF_MODE_TRIANGLES ? idx_count / 3 : (idx_count >= 3 ? idx_count - 2 : 0);
+        model_reserve(model, 0, triangles, true);
+
+        for (size_t t = 0; t < triangles; ++t)
+        {
+            unsigned int a, b, c;
+            if (mode == GLTF_MODE_TRIANGLES)
+            {
+                a = idxs[3 * t];
+                b = idxs[3 * t + 1];
+                c = idxs[3 * t + 2];
+            }
+            else if (mode == GLTF_MODE_TRIANGLE_STRIP)
+            {
+                // Every other triangle of the strip has the opposite winding.
+                a = idxs[t];
+                b = idxs[t + 1 + t % 2];
+                c = idxs[t + 2 - t % 2];
+            }
+            else
+            {
+                a = idxs[0];
+                b = idxs[t + 1];
+                c = idxs[t + 2];
+            }
+
+            if (flip)
+                model_add_face(model, a, c, b, material);
+            else
+                model_add_face(model, a, b, c, material);
+        }
+    }
+
+    free(idxs);
+    return loaded;
+}
+
+static bool glb_load_mesh(struct model *model, const struct glb_file *glb,
+        const struct json_value *mesh, const float *m)
+{
+    if (!mesh || mesh->type != JSON_OBJECT)
+    {
+        fprintf(stderr, "ERROR: Invalid glTF mesh.\n");
+        return false;
+    }
+
+    // A negative determinant mirrors the mesh, the winding has to be reversed to keep it.
+    float det = m[0] * (m[5] * m[10] - m[9] * m[6]) - m[4] * (m[1] * m[10] - m[9] * m[2])
+            + m[8] * (m[1] * m[6] - m[5] * m[2]);
+
+    const struct json_value *primitives = json_get(mesh, "primitives");
+    for (const struct json_value *p = primitives ? primitives->first : NULL; p; p = p->next)
+    {
+        if (!glb_load_primitive(model, glb, p, m, det < 0))
+            return false;
+    }
+    return true;
+}
+
+static bool glb_load_node(struct model *model, const struct glb_file *glb,
+        const struct json_value *node_index, const float *parent, int depth)
+{
+    const struct json_value *node = glb_item(glb, "nodes", node_index);
+    if (!node || depth > GLB_MAX_NODE_DEPTH)
+    {
+        fprintf(stderr, "ERROR: Invalid glTF node.\n");
+        return false;
+    }
+
+    float local[16], m[16];
+    glb_node_matrix(node, local);
+    glb_matrix_multiply(m, parent, local);
+
+    const struct json_value *mesh = json_get(node, "mesh");
+    if (mesh && !glb_load_mesh(model, glb, glb_item(glb, "meshes", mesh), m))
+        return false;
+
+    const struct json_value *children = json_get(node, "children");
+    for (const struct json_value *c = children ? children->first : NULL; c; c = c->next)
+    {
+        if (!glb_load_node(model, glb, c, m, depth + 1))
+            return false;
+    }
+    return true;
+}
+
+static void glb_load_materials(struct model *model, struct glb_file *glb)
+{
+    const struct json_value *materials = json_get(glb->json, "materials");
+
+    glb->materials_count = materials ? materials->count : 0;
+    if (glb->materials_count == 0)
+        return;
+    if (!(glb->materials = malloc(glb->materials_count * sizeof(*glb->materials))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+    model->load_stats.allocations++;
+
+    size_t i = 0;
+    for (const struct json_value *mat = materials ? materials->first : NULL; mat; mat = mat->next, ++i)
+    {
+        const struct json_value *color = json_get(json_get(mat, "pbrMetallicRoughness"), "baseColorFactor");
+        const struct json_value *name = json_get(mat, "name");
+
+        char default_name[32];
+        const char *name_str = default_name;
+        size_t name_len;
+        if (name && name->type == JSON_STRING)
+        {
+            name_str = name->string;
+            name_len = name->string_len;
+        }
+        else
+            name_len = snprintf(default_name, sizeof(default_name), "material%zu", i);
+
+        glb->materials[i] = model->materials_count;
+        model_add_material(model, name_str, name_len, json_number(json_at(color, 0), 1),
+                json_number(json_at(color, 1), 1), json_number(json_at(color, 2), 1));
+    }
+}
+
+struct model *model_load_from_glb(const char *fname, bool color_support)
+{
+    unsigned long long start_time = get_current_useconds();
+
+    struct model_input input;
+    if (!model_input_open(&input, fname))
+        return NULL;
+
+    // Create a new model
+    struct model *model = model_init();
+
+    struct arena arena;
+    arena_init(&arena, GLB_JSON_BLOCK_SIZE);
+
+    struct glb_file glb;
+    glb.materials = NULL;
+    glb.materials_count = 0;
+    bool loaded = glb_parse_chunks(&glb, &input.file, &arena);
+
+    if (loaded && color_support)
+        glb_load_materials(model, &glb);
+
+    if (loaded)
+    {
+        // Meshes of the default scene placed by their nodes, or every mesh when there are no scenes.
+        const struct json_value *scenes = json_get(glb.json, "scenes");
+        if (scenes)
+        {
+            const struct json_value *scene = json_get(glb.json, "scene") ?
+                    glb_item(&glb, "scenes", json_get(glb.json, "scene")) : scenes->first;
+            const struct json_value *nodes = json_get(scene, "nodes");
+            for (const struct json_value *n = nodes ? nodes->first : NULL; n && loaded; n = n->next)
+                loaded = glb_load_node(model, &glb, n, GLB_IDENTITY, 0);
+        }
+        else
+        {
+            const struct json_value *meshes = json_get(glb.json, "meshes");
+            for (const struct json_value *mesh = meshes ? meshes->first : NULL; mesh && loaded; mesh = mesh->next)
+                loaded = glb_load_mesh(model, &glb, mesh, GLB_IDENTITY);
+        }
+    }
+
+    free(glb.materials);
+    model->load_stats.allocations += arena.allocations;
+    arena_free(&arena);
+
+    model->load_stats.parse_useconds = get_current_useconds() - start_time;
+
+    model_input_close(&input, model);
+
+    if (!loaded)
+    {
+        model_free(model);
+        return NULL;
+    }
+
+    model_validate_idxs(model);
+    return model;
+}
+
+#define BINARY_MAGIC "3DAV"
+#define BINARY_VERSION 1
+#define BINARY_ALIGNMENT 64
+
+struct binary_header
+{
+    char magic[4];
+    uint32_t version;
+
+    uint32_t vertex_count;
+    uint32_t faces_count;
+    uint32_t materials_count;
+
+    uint32_t source_flags;
+    uint64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint32_t source_path_length;
+
+    uint32_t materials_size;
+    uint64_t vertexes_offset;
+    uint64_t faces_offset;
+    uint64_t file_size;
+};
+
+// Layout: header, source path, materials (Kd and name, each), vertexes and faces (aligned).
+// NOTE: Assuming the binary model is read by the same architecture that wrote it.
+
+static uint64_t binary_align(uint64_t offset)
+{
+    return (offset + BINARY_ALIGNMENT - 1) / BINARY_ALIGNMENT * BINARY_ALIGNMENT;
+}
+
+static bool binary_source_matches(const struct binary_header *header, const char *path,
+        const struct model_source *source)
+{
+    return header->source_flags == source->flags
+        && header->source_size == source->size
+        && header->source_mtime_sec == source->mtime_sec
+        && header->source_mtime_nsec == source->mtime_nsec
+        && header->source_path_length == strlen(source->path)
+        && memcmp(path, source->path, header->source_path_length) == 0;
+}
+
+struct model *model_load_from_binary(const char *fname, const struct model_source *source)
+{
+    struct mapped_file file;
+    if (!mapped_file_open(&file, fname, true))
+    {
+        if (!source)
+            fprintf(stderr, "ERROR: failed to load file \"%s\".\n", fname);
+        return NULL;
+    }
+
+    unsigned long long start_time = get_current_useconds();
+
+    struct binary_header header;
+    const char *path = file.data + sizeof(header);
+    if (file.size >= sizeof(header))
+        memcpy(&header, file.data, sizeof(header));
+
+    // The offsets are checked before adding to them, so that the sums can't wrap
+    if (file.size < sizeof(header) || memcmp(header.magic, BINARY_MAGIC, 4) != 0
+            || header.version != BINARY_VERSION || header.file_size != file.size
+            || header.vertexes_offset > file.size || header.faces_offset > file.size
+            || header.vertexes_offset % BINARY_ALIGNMENT != 0
+            || header.faces_offset % BINARY_ALIGNMENT != 0
+            || (uint64_t) header.vertex_count * sizeof(vec3) > file.size - header.vertexes_offset
+            || (uint64_t) header.faces_count * sizeof(struct face) > file.size - header.faces_offset
+            || sizeof(header) + (uint64_t) header.source_path_length + header.materials_size
+                > header.vertexes_offset)
+    {
+        if (!source)
+            fprintf(stderr, "ERROR: invalid binary model \"%s\".\n", fname);
+        mapped_file_close(&file);
+        return NULL;
+    }
+
+    if (source && !binary_source_matches(&header, path, source))
+    {
+        mapped_file_close(&file);
+        return NULL;
+    }
+
+    struct model *model = model_init();
+
+    // Materials are copied
+    const char *p = path + header.source_path_length;
+    const char *materials_end = p + header.materials_size;
+    for (uint32_t i = 0; i < header.materials_count; ++i)
+    {
+        float kd[3];
+        uint32_t name_length;
+
+        if (materials_end - p < sizeof(kd) + sizeof(name_length))
+            break;
+        memcpy(kd, p, sizeof(kd));
+        memcpy(&name_length, p + sizeof(kd), sizeof(name_length));
+        p += sizeof(kd) + sizeof(name_length);
+
+        if (materials_end - p < name_length)
+            break;
+        model_add_material(model, p, name_length, kd[0], kd[1], kd[2]);
+        p += name_length;
+    }
+    if (model->materials_count != header.materials_count)
+    {
+        if (!source)
+            fprintf(stderr, "ERROR: invalid binary model \"%s\".\n", fname);
+        mapped_file_close(&file);
+        model_free(model);
+        return NULL;
+    }
+
+    // Vertexes and faces stay in the mapped file
+    free(model->vertexes);
+    free(model->faces);
+    model->vertexes = (vec3 *) (file.data + header.vertexes_offset);
+    model->vertex_count = model->vertex_capacity = header.vertex_count;
+    model->faces = (struct face *) (file.data + header.faces_offset);
+    model->faces_count = model->faces_capacity = header.faces_count;
+    model->storage = file;
+
+    // The file is mapped copy-on-write, so the fixes stay in this process
+    model_validate_idxs(model);
+    for (int f = 0; f < model->faces_count; ++f)
+    {
+        int material = model->faces[f].material;
+        if (material != -1 && (material < 0 || material >= model->materials_count))
+        {
+            fprintf(stderr, "WARN: Invalid material index %d.\n", material);
+            model->faces[f].material = -1;
+        }
+    }
+
+    model->load_stats.file_bytes = file.size;
+    model->load_stats.parse_useconds = get_current_useconds() - start_time;
+
+    return model;
+}
+
+static bool binary_write_padding(FILE *fp, uint64_t *offset)
+{
+    static const char zeros[BINARY_ALIGNMENT] = {0};
+
+    uint64_t aligned = binary_align(*offset);
+    if (fwrite(zeros, 1, aligned - *offset, fp) != aligned - *offset)
+        return false;
+    *offset = aligned;
+    return true;
+}
+
+bool model_save_binary(const struct model *model, const char *fname, const struct model_source *source)
+{
+    struct binary_header header = {0};
+    memcpy(header.magic, BINARY_MAGIC, 4);
+    header.version = BINARY_VERSION;
+    header.vertex_count = model->vertex_count;
+    header.faces_count = model->faces_count;
+    header.materials_count = model->materials_count;
+
+    const char *path = "";
+    if (source)
+    {
+        path = source->path;
+        header.source_flags = source->flags;
+        header.source_size = source->size;
+        header.source_mtime_sec = source->mtime_sec;
+        header.source_mtime_nsec = source->mtime_nsec;
+    }
+    header.source_path_length = strlen(path);
+
+    for (unsigned int i = 0; i < model->materials_count; ++i)
+        header.materials_size += sizeof(float[3]) + sizeof(uint32_t) + strlen(model->materials[i].name);
+
+    header.vertexes_offset = binary_align(sizeof(header) + header.source_path_length + header.materials_size);
+    header.faces_offset = binary_align(header.vertexes_offset + (uint64_t) model->vertex_count * sizeof(vec3));
+    header.file_size = header.faces_offset + (uint64_t) model->faces_count * sizeof(struct face);
+
+    // Written to a temporary file first, so other processes never see a partial file.
+    char *tmp_fname;
+    if (!(tmp_fname = malloc(strlen(fname) + 32)))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+    sprintf(tmp_fname, "%s.%ld.tmp", fname, (long) getpid());
+
+    FILE *fp = fopen(tmp_fname, "wb");
+    if (!fp)
+    {
+        free(tmp_fname);
+        return false;
+    }
+
+    uint64_t offset = sizeof(header) + header.source_path_length + header.materials_size;
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = ok && fwrite(path, 1, header.source_path_length, fp) == header.source_path_length;
+
+    for (unsigned int i = 0; ok && i < model->materials_count; ++i)
+    {
+        const struct material *material = &model->materials[i];
+        float kd[3] = {material->Kd_r, material->Kd_g, material->Kd_b};
+        uint32_t name_length = strlen(material->name);
+
+        ok = ok && fwrite(kd, sizeof(kd), 1, fp) == 1;
+        ok = ok && fwrite(&name_length, sizeof(name_length), 1, fp) == 1;
+        ok = ok && fwrite(material->name, 1, name_length, fp) == name_length;
+    }
+
+    ok = ok && binary_write_padding(fp, &offset);
+    ok = ok && fwrite(model->vertexes, sizeof(vec3), model->vertex_count, fp) == model->vertex_count;
+    offset += (uint64_t) model->vertex_count * sizeof(vec3);
+    ok = ok && binary_write_padding(fp, &offset);
+    ok = ok && fwrite(model->faces, sizeof(struct face), model->faces_count, fp) == model->faces_count;
+
+    ok = (fclose(fp) == 0) && ok;
+    ok = ok && rename(tmp_fname, fname) == 0;
+    if (!ok)
+        remove(tmp_fname);
+
+    free(tmp_fname);
+    return ok;
 }
@@ -1,11 +1,13 @@
 #pragma once
 
+#include "arena.h"
+#include "mapped_file.h"
 #include "trigonometry.h"
+#include "vertex_kernel.h"
 
+#include <pthread.h>
 #include <stdbool.h>
 
-#define MATERIAL_NAME_BUFFER_SIZE 256
-
 struct face
 {
     unsigned int idxs[3];
@@ -14,10 +16,27 @@ struct face
 
 struct material
 {
-    char name[MATERIAL_NAME_BUFFER_SIZE];
+    const char *name; // Interned in the model's material_names.
     float Kd_r, Kd_g, Kd_b;
 };
 
+// Measurements taken while loading a model.
+struct model_load_stats
+{
+    unsigned long long file_bytes;
+    // Size of the file before decompression, 0 if it was not compressed.
+    unsigned long long compressed_bytes;
+    // Time of the whole loader, including the triangularization.
+    unsigned long long parse_useconds;
+    unsigned long long triangularize_useconds;
+    // Time checking the face indexes, after the loader.
+    unsigned long long validate_useconds;
+    // Heap allocations done by the loader.
+    unsigned long long allocations;
+    unsigned int welded_vertexes;
+    bool from_cache;
+};
+
 struct model
 {
     unsigned int vertex_count;
@@ -28,23 +47,151 @@ struct model
     unsigned int faces_capacity;
     struct face *faces;
 
+    // Copy of the positions for the vertex kernels, empty until model_compute_soa is called.
+    struct vertex_soa soa;
+
+    // Unit normal of each face, NULL until model_compute_normals is called.
+    unsigned int normals_count;
+    vec3 *normals;
+    // Groups of consecutive faces, NULL until model_compute_clusters is called.
+    unsigned int clusters_count;
+    struct face_cluster *clusters;
+    unsigned int cluster_nodes_count;
+    struct cluster_node *cluster_nodes;
+    // Character of each face lit by the static light, cached by the viewer (NULL if not cached).
+    char *static_chars;
+
     unsigned int materials_count;
     unsigned int materials_capacity;
     struct material *materials;
+    // Pool holding the material names.
+    struct arena material_names;
+    // Open addressing hash table from material name to its index + 1 (0 for empty slots).
+    unsigned int material_table_size;
+    unsigned int *material_table;
+
+    struct model_load_stats load_stats;
+
+    // File holding the vertexes and faces, when loaded from a binary model.
+    struct mapped_file storage;
+};
+
+// Identifies the file a binary model was made from, and the options used to load it.
+struct model_source
+{
+    const char *path;
+    unsigned long long size;
+    long long mtime_sec, mtime_nsec;
+    unsigned int flags;
 };
 
-struct model *model_load_from_obj(const char *fname, bool color_support);
-struct model *model_load_from_stl(const char *fname);
+// Number of positions sampled to estimate the bounds of a model that is being loaded.
+#define MODEL_PROGRESS_SAMPLES 1024
+
+// Shared with other threads while a model is loaded progressively, to show the part loaded so far.
+// All the fields are guarded by the mutex.
+struct model_progress
+{
+    pthread_mutex_t mutex;
+
+    // Model being loaded, only the published vertexes, faces and materials can be read.
+    const struct model *model;
+    unsigned int vertex_count;
+    unsigned int faces_count;
+    unsigned int materials_count;
+    // Nothing else will be published, the model may be modified from now on.
+    bool complete;
+    // Set by the reader to stop the loading, the loader returns NULL.
+    bool cancelled;
+
+    // Positions spread over the whole model, to estimate its bounds before it is loaded.
+    vec3 samples[MODEL_PROGRESS_SAMPLES];
+    int samples_count;
+    bool samples_ready;
+
+    unsigned long long bytes_total;
+    unsigned long long bytes_done;
+
+    // Parts already copied by model_progress_copy.
+    unsigned int copied_vertexes;
+    unsigned int copied_faces;
+};
+
+void model_progress_init(struct model_progress *progress);
+void model_progress_destroy(struct model_progress *progress);
+
+// Model with the sampled positions as vertexes, NULL if they are not available yet.
+struct model *model_progress_samples(struct model_progress *progress);
+
+// Append to dst the vertexes, faces and materials published since the last call. The faces stop
+// at the first one that uses vertexes that are not loaded yet, which is copied by a later call.
+// Returns false if there was nothing new.
+bool model_progress_copy(struct model_progress *progress, struct model *dst);
+
+// Create an empty model.
+struct model *model_init(void);
+
+// Load the model, if progress is not NULL it is loaded in parts that are published as they are ready.
+struct model *model_load_from_obj(const char *fname, bool color_support, struct model_progress *progress);
+struct model *model_load_from_stl(const char *fname, struct model_progress *progress);
+// Load a PLY model, in ASCII or binary little-endian format.
+struct model *model_load_from_ply(const char *fname);
+// Load a GLB (binary glTF 2.0) model, with the meshes of its default scene.
+struct model *model_load_from_glb(const char *fname, bool color_support);
+
+// View of the vertexes and faces of the model starting from the given ones, to transform only them.
+// The faces keep indexing the vertexes of the whole model.
+struct model model_tail(const struct model *model, unsigned int first_vertex, unsigned int first_face);
+
+// Load a model saved with model_save_binary, its arrays are mapped from the file.
+// If source is not NULL, returns NULL (silently) unless the model was made from that source.
+struct model *model_load_from_binary(const char *fname, const struct model_source *source);
+
+// Save the model in a binary format, source may be NULL.
+bool model_save_binary(const struct model *model, const char *fname, const struct model_source *source);
+
+// Copy the positions of the vertexes from first_vertex on to the SoA arrays, the previous ones are kept.
+void model_compute_soa(struct model *model, unsigned int first_vertex);
+
+// Bounds of the vertexes, that must not be empty. Uses the vertex kernels if the SoA arrays are up to date.
+struct vertex_bounds model_bounds(const struct model *model);
+
+// Compute the normals of the faces from first_face on, the previous ones are kept.
+void model_compute_normals(struct model *model, unsigned int first_face);
 
 void model_invert_triangles(struct model *model);
 
 // Scale the model so that it fits in the [-1, 1]^3 cube with any rotation.
 void model_normalize(struct model *model);
 
+// Merge vertexes with the same (quantized) position and drop the faces that become degenerate.
+void model_weld_vertexes(struct model *model);
+
+// Simplified copy of the model, the vertexes in each cell of a grid starting at min (below all the
+// vertexes) are merged into the position with the smallest quadric error of their planes, within
+// the cell. Faces that collapse are dropped, the materials are not copied.
+struct model *model_simplify(const struct model *model, vec3 min, float cell_size);
+
 void model_change_orientation(struct model *model, int axis1, int axis2, int axis3);
 
 void model_invert_x(struct model *model);
 void model_invert_y(struct model *model);
 void model_invert_z(struct model *model);
 
+// Changes of the axes and faces of a model, applied in this order.
+struct model_orientation
+{
+    // Axes of the model that become the x, y and z ones.
+    int axes[3];
+    bool axes_flip_faces;
+    bool flip_faces;
+    bool invert_x, invert_y, invert_z;
+};
+
+// Apply the orientation to the model, that isn't written if it is the default one.
+void model_orient(struct model *model, const struct model_orientation *orientation);
+
+// Free the vertexes and faces, keeping the materials.
+void model_release_geometry(struct model *model);
+
 void model_free(struct model *model);
@@ -0,0 +1,227 @@
+#include "raster_bins.h"
+#include "threads.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct binned_triangle
+{
+    struct triangle tri;
+    struct surface_rect rect;
+    bool inverted_orientation;
+    char c;
+    int material;
+};
+
+// Bins left to a thread, the index of the first one in the low half and the end in the high one.
+// The thread takes them from the front, the others steal them from the back once they finish theirs.
+struct bin_queue
+{
+    _Alignas(64) _Atomic uint64_t range;
+    // Occlusion tests of the thread
+    struct occlusion_stats stats;
+};
+
+struct draw_job
+{
+    struct raster_bins *bins;
+    struct bin_queue *queues;
+};
+
+static void *bins_grow(void *array, unsigned int *capacity, unsigned int count, size_t size)
+{
+    if (count > *capacity)
+    {
+        *capacity = *capacity ? 2 * *capacity : 64;
+        if (*capacity < count)
+            *capacity = count;
+        if (!(array = realloc(array, *capacity * size)))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+    }
+    return array;
+}
+
+void raster_bins_begin(struct raster_bins *bins, struct surface *surface, int threads)
+{
+    bins->surface = surface;
+    bins->bins_x = surface->bins_x;
+    bins->bins_y = surface->bins_y;
+    bins->triangles_count = 0;
+
+    unsigned int bins_count = bins->bins_x * bins->bins_y;
+    bins->threads = (threads < (int) bins_count) ? threads : (int) bins_count;
+    if (bins->threads <= 1)
+        return;
+
+    bins->bin_starts = bins_grow(bins->bin_starts, &bins->bins_capacity, bins_count + 1,
+            sizeof(*bins->bin_starts));
+    memset(bins->bin_starts, 0, (bins_count + 1) * sizeof(*bins->bin_starts));
+}
+
+void raster_bins_add(struct raster_bins *bins, struct triangle tri, bool inverted_orientation, char c,
+        int material)
+{
+    if (bins->threads <= 1)
+    {
+        surface_draw_triangle(bins->surface, tri, inverted_orientation, c, material);
+        return;
+    }
+
+    struct surface_rect rect;
+    if (!surface_triangle_rect(bins->surface, &tri, inverted_orientation, &rect))
+        return;
+
+    bins->triangles = bins_grow(bins->triangles, &bins->triangles_capacity, bins->triangles_count + 1,
+            sizeof(*bins->triangles));
+    bins->triangles[bins->triangles_count++] = (struct binned_triangle){tri, rect,
+            inverted_orientation, c, material};
+
+    // Counted after the bin, so that they become its start when accumulated
+    for (int by = rect.yyi >> SURFACE_BIN_SHIFT_Y; by <= rect.yyf >> SURFACE_BIN_SHIFT_Y; ++by)
+    {
+        for (int bx = rect.xxi >> SURFACE_BIN_SHIFT_X; bx <= rect.xxf >> SURFACE_BIN_SHIFT_X; ++bx)
+            bins->bin_starts[by * bins->bins_x + bx + 1]++;
+    }
+}
+
+// Sort the triangles by bin, keeping their order in each one.
+static void bins_sort(struct raster_bins *bins)
+{
+    unsigned int bins_count = bins->bins_x * bins->bins_y;
+    for (unsigned int b = 0; b < bins_count; ++b)
+        bins->bin_starts[b + 1] += bins->bin_starts[b];
+
+    bins->refs = bins_grow(bins->refs, &bins->refs_capacity, bins->bin_starts[bins_count],
+            sizeof(*bins->refs));
+
+    // The start of each bin is moved to its end as it is filled
+    for (unsigned int i = 0; i < bins->triangles_count; ++i)
+    {
+        struct surface_rect rect = bins->triangles[i].rect;
+        for (int by = rect.yyi >> SURFACE_BIN_SHIFT_Y; by <= rect.yyf >> SURFACE_BIN_SHIFT_Y; ++by)
+        {
+            for (int bx = rect.xxi >> SURFACE_BIN_SHIFT_X; bx <= rect.xxf >> SURFACE_BIN_SHIFT_X; ++bx)
+                bins->refs[bins->bin_starts[by * bins->bins_x + bx]++] = i;
+        }
+    }
+    memmove(bins->bin_starts + 1, bins->bin_starts, bins_count * sizeof(*bins->bin_starts));
+    bins->bin_starts[0] = 0;
+}
+
+static bool bin_queue_take(struct bin_queue *queue, bool front, unsigned int *bin)
+{
+    uint64_t range = atomic_load(&queue->range);
+    while (true)
+    {
+        uint32_t first = range;
+        uint32_t end = range >> 32;
+        if (first >= end)
+            return false;
+
+        uint64_t next = front ? range + 1 : range - ((uint64_t) 1 << 32);
+        if (atomic_compare_exchange_weak(&queue->range, &range, next))
+        {
+            *bin = front ? first : end - 1;
+            return true;
+        }
+    }
+}
+
+static void draw_bin(struct raster_bins *bins, unsigned int bin, struct occlusion_stats *stats)
+{
+    struct surface *surface = bins->surface;
+    struct surface_rect clip = surface_bin_rect(surface, bin % bins->bins_x, bin / bins->bins_x);
+
+    for (unsigned int i = bins->bin_starts[bin]; i < bins->bin_starts[bin + 1]; ++i)
+    {
+        const struct binned_triangle *t = &bins->triangles[bins->refs[i]];
+        surface_draw_triangle_clipped(surface, t->tri, t->inverted_orientation, t->c, t->material, clip,
+                stats);
+    }
+}
+
+static void draw_job(void *data, int index)
+{
+    struct draw_job *job = data;
+    struct bin_queue *own = &job->queues[index];
+    int threads = job->bins->threads;
+
+    unsigned int bin;
+    while (bin_queue_take(own, true, &bin))
+        draw_bin(job->bins, bin, &own->stats);
+
+    for (int k = 1; k < threads; ++k)
+    {
+        struct bin_queue *victim = &job->queues[(index + k) % threads];
+        while (bin_queue_take(victim, false, &bin))
+            draw_bin(job->bins, bin, &own->stats);
+    }
+}
+
+void raster_bins_draw(struct raster_bins *bins)
+{
+    if (bins->threads <= 1 || bins->triangles_count == 0)
+        return;
+
+    bins_sort(bins);
+
+    if (!bins->pool)
+        bins->pool = thread_pool_init();
+
+    if (bins->threads > bins->queues_capacity)
+    {
+        free(bins->queues);
+        if (!(bins->queues = aligned_alloc(_Alignof(struct bin_queue),
+                bins->threads * sizeof(*bins->queues))))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+        bins->queues_capacity = bins->threads;
+    }
+    struct bin_queue *queues = bins->queues;
+
+    // Consecutive bins with about the same number of triangles for each thread, one more per bin for
+    // the empty ones
+    unsigned int bins_count = bins->bins_x * bins->bins_y;
+    unsigned long long total = bins->bin_starts[bins_count] + bins_count;
+    unsigned int first = 0;
+    for (int t = 0; t < bins->threads; ++t)
+    {
+        unsigned long long goal = total * (t + 1) / bins->threads;
+        unsigned int end = first;
+        while (end < bins_count && bins->bin_starts[end] + end < goal)
+            end++;
+        if (t == bins->threads - 1)
+            end = bins_count;
+
+        atomic_init(&queues[t].range, first | ((uint64_t) end << 32));
+        queues[t].stats = (struct occlusion_stats){0, 0};
+        first = end;
+    }
+
+    struct draw_job job = {bins, queues};
+    thread_pool_run(bins->pool, bins->threads, draw_job, &job);
+
+    for (int t = 0; t < bins->threads; ++t)
+    {
+        bins->surface->occlusion.tests += queues[t].stats.tests;
+        bins->surface->occlusion.rejects += queues[t].stats.rejects;
+    }
+}
+
+void raster_bins_free(struct raster_bins *bins)
+{
+    free(bins->triangles);
+    free(bins->bin_starts);
+    free(bins->refs);
+    if (bins->pool)
+        thread_pool_free(bins->pool);
+    free(bins->queues);
+}
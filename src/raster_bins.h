@@ -0,0 +1,42 @@
+#pragma once
+
+#include "surface.h"
+
+// Triangles of a frame sorted into the bins of the surface they may be drawn on, so that the bins
+// are drawn in parallel. Each bin is drawn by a single thread, with its triangles in the order they
+// were added, so the result is the same as drawing them one after the other. A zeroed struct is
+// empty.
+struct raster_bins
+{
+    struct surface *surface;
+    unsigned int bins_x, bins_y;
+    int threads;
+
+    struct binned_triangle *triangles;
+    unsigned int triangles_count;
+    unsigned int triangles_capacity;
+
+    // Triangles in each bin, then the offset of the first one of each bin in refs.
+    unsigned int *bin_starts;
+    unsigned int bins_capacity;
+    unsigned int *refs;
+    unsigned int refs_capacity;
+
+    // Threads that draw the bins, started with the first frame drawn in parallel, and the queues of
+    // bins of each one.
+    struct thread_pool *pool;
+    struct bin_queue *queues;
+    int queues_capacity;
+};
+
+// Start a frame on the surface with up to the given number of threads. With one, the triangles are
+// drawn as they are added.
+void raster_bins_begin(struct raster_bins *bins, struct surface *surface, int threads);
+
+void raster_bins_add(struct raster_bins *bins, struct triangle tri, bool inverted_orientation, char c,
+        int material);
+
+// Draw the triangles added since the frame started.
+void raster_bins_draw(struct raster_bins *bins);
+
+void raster_bins_free(struct raster_bins *bins);
@@ -0,0 +1,101 @@
+#include "render_thread.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct render_thread
+{
+    void (*draw)(void *data, struct surface *surface);
+    void *data;
+    pthread_t thread;
+
+    // Surfaces handed over in each direction, NULL when there is none. Handing NULL to the thread
+    // stops it. The semaphores only put the threads to sleep until there is one.
+    _Atomic(struct surface *) requested;
+    _Atomic(struct surface *) drawn;
+    sem_t requested_count;
+    sem_t drawn_count;
+
+    // Whether the thread has a surface, only used by the caller.
+    bool busy;
+};
+
+// Wait for the semaphore, also when a signal interrupts it.
+static void semaphore_wait(sem_t *sem)
+{
+    while (sem_wait(sem) != 0)
+        continue;
+}
+
+static void *render_thread_main(void *arg)
+{
+    struct render_thread *thread = arg;
+    while (true)
+    {
+        semaphore_wait(&thread->requested_count);
+        struct surface *surface = atomic_exchange(&thread->requested, NULL);
+        if (!surface)
+            return NULL;
+
+        thread->draw(thread->data, surface);
+
+        atomic_store(&thread->drawn, surface);
+        sem_post(&thread->drawn_count);
+    }
+}
+
+struct render_thread *render_thread_start(void (*draw)(void *data, struct surface *surface), void *data)
+{
+    struct render_thread *thread;
+    if (!(thread = malloc(sizeof(*thread))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+
+    thread->draw = draw;
+    thread->data = data;
+    atomic_init(&thread->requested, NULL);
+    atomic_init(&thread->drawn, NULL);
+    sem_init(&thread->requested_count, 0, 0);
+    sem_init(&thread->drawn_count, 0, 0);
+    thread->busy = false;
+
+    if (pthread_create(&thread->thread, NULL, render_thread_main, thread) != 0)
+    {
+        fprintf(stderr, "ERROR: Failed to create thread.\n");
+        exit(1);
+    }
+    return thread;
+}
+
+void render_thread_draw(struct render_thread *thread, struct surface *surface)
+{
+    thread->busy = true;
+    atomic_store(&thread->requested, surface);
+    sem_post(&thread->requested_count);
+}
+
+struct surface *render_thread_wait(struct render_thread *thread)
+{
+    semaphore_wait(&thread->drawn_count);
+    thread->busy = false;
+    return atomic_exchange(&thread->drawn, NULL);
+}
+
+void render_thread_stop(struct render_thread *thread)
+{
+    if (thread->busy)
+        render_thread_wait(thread);
+
+    atomic_store(&thread->requested, NULL);
+    sem_post(&thread->requested_count);
+    pthread_join(thread->thread, NULL);
+
+    sem_destroy(&thread->requested_count);
+    sem_destroy(&thread->drawn_count);
+    free(thread);
+}
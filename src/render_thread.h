@@ -0,0 +1,20 @@
+#pragma once
+
+#include "surface.h"
+
+// Thread that draws the next frame while the current one is printed. The surfaces are handed over
+// to it and back without locks, one at a time.
+struct render_thread;
+
+// Start the thread, that draws the frames calling draw(data, surface).
+struct render_thread *render_thread_start(void (*draw)(void *data, struct surface *surface), void *data);
+
+// Start drawing a frame on the surface, that belongs to the thread until render_thread_wait returns
+// it. The changes made to data before are seen by draw.
+void render_thread_draw(struct render_thread *thread, struct surface *surface);
+
+// Wait for the frame and return its surface.
+struct surface *render_thread_wait(struct render_thread *thread);
+
+// Stop the thread, waiting for the frame it is drawing if any.
+void render_thread_stop(struct render_thread *thread);
@@ -0,0 +1,113 @@
+#include "scan.h"
+
+#include <stdlib.h>
+
+#define SCAN_SLOW_BUFFER_SIZE 128
+
+// Powers of 10 that are exactly representable as doubles.
+static const double EXACT_POWERS_OF_10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static float scan_parse_float_slow(const char *str, const char *end)
+{
+    char buffer[SCAN_SLOW_BUFFER_SIZE];
+    size_t len = end - str;
+
+    if (len >= sizeof(buffer))
+        len = sizeof(buffer) - 1;
+    memcpy(buffer, str, len);
+    buffer[len] = '\0';
+
+    // NOTE: Only reached by unusual numbers, the program never changes the "C" locale.
+    return (float) strtod(buffer, NULL);
+}
+
+float scan_parse_float(const char *str, const char *end)
+{
+    const char *p = str;
+    bool neg = false;
+
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        neg = *p == '-';
+        p++;
+    }
+
+    // Hexadecimal, infinities and NaNs are left to strtod.
+    if (p >= end || !((*p >= '0' && *p <= '9') || *p == '.'))
+        return scan_parse_float_slow(str, end);
+    if (p + 1 < end && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+        return scan_parse_float_slow(str, end);
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any_digit = false;
+
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        if (mantissa != 0 || *p != '0')
+            digits++;
+        if (digits > 19)
+            return scan_parse_float_slow(str, end);
+        mantissa = mantissa * 10 + (*p - '0');
+        any_digit = true;
+        p++;
+    }
+    if (p < end && *p == '.')
+    {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9')
+        {
+            if (mantissa != 0 || *p != '0')
+                digits++;
+            if (digits > 19)
+                return scan_parse_float_slow(str, end);
+            mantissa = mantissa * 10 + (*p - '0');
+            exponent--;
+            any_digit = true;
+            p++;
+        }
+    }
+    if (!any_digit)
+        return 0.0f;
+
+    // The exponent is only consumed if there are digits after it, like strtod does.
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        bool exp_neg = false;
+
+        if (q < end && (*q == '-' || *q == '+'))
+        {
+            exp_neg = *q == '-';
+            q++;
+        }
+        if (q < end && *q >= '0' && *q <= '9')
+        {
+            int exp_val = 0;
+            while (q < end && *q >= '0' && *q <= '9')
+            {
+                if (exp_val < 100000)
+                    exp_val = exp_val * 10 + (*q - '0');
+                q++;
+            }
+            exponent += exp_neg ? -exp_val : exp_val;
+        }
+    }
+
+    // Fast path: both the mantissa and the power of 10 are exact doubles, so a single
+    // multiplication or division gives the correctly rounded result, the same as strtod.
+    if (mantissa > (1ull << 53) || exponent < -22 || exponent > 22)
+        return scan_parse_float_slow(str, end);
+
+    double val = (double) mantissa;
+    if (exponent < 0)
+        val /= EXACT_POWERS_OF_10[-exponent];
+    else
+        val *= EXACT_POWERS_OF_10[exponent];
+
+    return (float) (neg ? -val : val);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// In-place tokenizer for text lines that are not NUL-terminated (e.g. in a mapped file).
+// Tokens are delimited by spaces or tabs, a '\r' or '\0' ends the line early.
+struct scanner
+{
+    const char *p;
+    const char *end;
+};
+
+// Returns the end of the line starting at p (the '\n' position, or end).
+static inline const char *scan_line_end(const char *p, const char *end)
+{
+    const char *eol = memchr(p, '\n', end - p);
+    return eol ? eol : end;
+}
+
+// Get the next token of the line, returns its length or 0 if the line has no more tokens.
+static inline size_t scan_token(struct scanner *sc, const char **tok)
+{
+    const char *p = sc->p;
+
+    while (p < sc->end && (*p == ' ' || *p == '\t'))
+        p++;
+
+    if (p < sc->end && (*p == '\r' || *p == '\0'))
+        p = sc->end;
+
+    *tok = p;
+    while (p < sc->end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\0')
+        p++;
+
+    sc->p = p;
+    return p - *tok;
+}
+
+static inline bool scan_token_equals(const char *tok, size_t len, const char *str)
+{
+    size_t i = 0;
+    for (; i < len; ++i)
+    {
+        if (str[i] != tok[i])
+            return false;
+    }
+    return str[i] == '\0';
+}
+
+// Parse the leading float of [str, end) with the same result as (float) atof(), but without
+// depending on the locale and without requiring a NUL-terminated string.
+float scan_parse_float(const char *str, const char *end);
+
+// Parse the leading integer of [str, end), same as atoi().
+static inline int scan_parse_int(const char *str, const char *end)
+{
+    bool neg = false;
+    long long val = 0;
+
+    if (str < end && (*str == '-' || *str == '+'))
+    {
+        neg = *str == '-';
+        str++;
+    }
+    while (str < end && *str >= '0' && *str <= '9')
+    {
+        if (val < INT64_MAX / 10)
+            val = val * 10 + (*str - '0');
+        str++;
+    }
+    return (int) (neg ? -val : val);
+}
+
+// Parse the next token as a float, ignoring anything after a '/'.
+static inline bool scan_float(struct scanner *sc, float *f)
+{
+    const char *tok;
+    size_t len = scan_token(sc, &tok);
+    if (len == 0)
+        return false;
+    *f = scan_parse_float(tok, tok + len);
+    return true;
+}
+
+// Parse the next token as an integer, ignoring anything after a '/'.
+static inline bool scan_int(struct scanner *sc, int *i)
+{
+    const char *tok;
+    size_t len = scan_token(sc, &tok);
+    if (len == 0)
+        return false;
+    *i = scan_parse_int(tok, tok + len);
+    return true;
+}
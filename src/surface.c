@@ -1,8 +1,13 @@
 #include "surface.h"
 
 #include <assert.h>
+#include <math.h>
 #include <ncurses.h>
 #include <stdlib.h>
+#include <string.h>
+
+// Pixels of the rectangle around a triangle from which it is tested against the coarse depth buffer.
+#define SURFACE_OCCLUSION_MIN_AREA 16
 
 static float mini(float a, float b)
 {
@@ -77,32 +82,141 @@ struct surface *surface_init(unsigned int size_x, unsigned int size_y, float log
     surface->dx = logical_size_x / size_x;
     surface->dy = logical_size_y / size_y;
 
-    if (!(surface->pixels = malloc(size_y * size_x * sizeof(*surface->pixels))))
+    if (!(surface->z = malloc(size_y * size_x * sizeof(*surface->z))) ||
+            !(surface->c = malloc(size_y * size_x * sizeof(*surface->c))) ||
+            !(surface->material = malloc(size_y * size_x * sizeof(*surface->material))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+
+    for (int level = 0; level < SURFACE_DEPTH_LEVELS; ++level)
+    {
+        struct depth_tiles *tiles = &surface->depth_levels[level];
+        unsigned int tile_x = 1 << (SURFACE_DEPTH_TILE_SHIFT_X + level);
+        unsigned int tile_y = 1 << (SURFACE_DEPTH_TILE_SHIFT_Y + level);
+        tiles->size_x = (size_x + tile_x - 1) / tile_x;
+        tiles->size_y = (size_y + tile_y - 1) / tile_y;
+        if (!(tiles->max_z = malloc(tiles->size_x * tiles->size_y * sizeof(*tiles->max_z))) ||
+                !(tiles->dirty = malloc(tiles->size_x * tiles->size_y * sizeof(*tiles->dirty))))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+    }
+
+    surface->bins_x = ((size_x - 1) >> SURFACE_BIN_SHIFT_X) + 1;
+    surface->bins_y = ((size_y - 1) >> SURFACE_BIN_SHIFT_Y) + 1;
+    if (!(surface->drawn = malloc(surface->bins_x * surface->bins_y * sizeof(*surface->drawn))))
     {
         fprintf(stderr, "ERROR: Memory allocation failure.\n");
         exit(1);
     }
+
+    // Cleared as if all of it was drawn
+    for (unsigned int by = 0; by < surface->bins_y; ++by)
+    {
+        for (unsigned int bx = 0; bx < surface->bins_x; ++bx)
+            surface->drawn[by * surface->bins_x + bx] = surface_bin_rect(surface, bx, by);
+    }
     surface_clear(surface);
 
     return surface;
 }
 
+struct surface_rect surface_bin_rect(const struct surface *surface, unsigned int bx, unsigned int by)
+{
+    struct surface_rect rect;
+    rect.xxi = bx << SURFACE_BIN_SHIFT_X;
+    rect.xxf = mini(surface->size_x, (bx + 1) << SURFACE_BIN_SHIFT_X) - 1;
+    rect.yyi = by << SURFACE_BIN_SHIFT_Y;
+    rect.yyf = mini(surface->size_y, (by + 1) << SURFACE_BIN_SHIFT_Y) - 1;
+    return rect;
+}
+
+// Set count floats to the value, copying the ones already set in blocks that double in size, so
+// that most of them are copied by memcpy with the widest vector instructions.
+static void fill_floats(float *dst, float value, unsigned int count)
+{
+    if (count == 0)
+        return;
+
+    dst[0] = value;
+    unsigned int filled = 1;
+    while (filled < count)
+    {
+        unsigned int block = mini(filled, count - filled);
+        memcpy(dst + filled, dst, block * sizeof(*dst));
+        filled += block;
+    }
+}
+
 void surface_clear(struct surface *surface)
 {
     assert(surface);
-    assert(surface->pixels);
+    assert(surface->z);
+
+    unsigned int bins_count = surface->bins_x * surface->bins_y;
+    unsigned int drawn_area = 0;
+    for (unsigned int b = 0; b < bins_count; ++b)
+    {
+        struct surface_rect *rect = &surface->drawn[b];
+        if (rect->xxi <= rect->xxf)
+            drawn_area += (rect->xxf - rect->xxi + 1) * (rect->yyf - rect->yyi + 1);
+    }
 
-    for (int i = 0; i < surface->size_y * surface->size_x; ++i)
+    // The material -1 has all the bits set. When most of the surface was drawn, it is cleared at once.
+    if (2 * drawn_area >= surface->size_x * surface->size_y)
     {
-        surface->pixels[i].z = INFINITY;
-        surface->pixels[i].c = ' ';
-        surface->pixels[i].material = -1;
+        unsigned int count = surface->size_x * surface->size_y;
+        fill_floats(surface->z, INFINITY, count);
+        memset(surface->c, ' ', count * sizeof(*surface->c));
+        memset(surface->material, 0xff, count * sizeof(*surface->material));
     }
+    else
+    {
+        // The columns are contiguous, so each one is cleared at once
+        for (unsigned int b = 0; b < bins_count; ++b)
+        {
+            struct surface_rect *rect = &surface->drawn[b];
+            for (int xx = rect->xxi; xx <= rect->xxf; ++xx)
+            {
+                unsigned int i = surface_index(surface, xx, rect->yyi);
+                unsigned int count = rect->yyf - rect->yyi + 1;
+                fill_floats(&surface->z[i], INFINITY, count);
+                memset(&surface->c[i], ' ', count * sizeof(*surface->c));
+                memset(&surface->material[i], 0xff, count * sizeof(*surface->material));
+            }
+        }
+    }
+    for (unsigned int b = 0; b < bins_count; ++b)
+        surface->drawn[b] = (struct surface_rect){0, -1, 0, -1};
+
+    for (int level = 0; level < SURFACE_DEPTH_LEVELS; ++level)
+    {
+        struct depth_tiles *tiles = &surface->depth_levels[level];
+        for (unsigned int i = 0; i < tiles->size_x * tiles->size_y; ++i)
+        {
+            tiles->max_z[i] = INFINITY;
+            tiles->dirty[i] = false;
+        }
+    }
+
+    surface->occlusion.tests = 0;
+    surface->occlusion.rejects = 0;
 }
 
 void surface_free(struct surface *surface)
 {
-    free(surface->pixels);
+    for (int level = 0; level < SURFACE_DEPTH_LEVELS; ++level)
+    {
+        free(surface->depth_levels[level].max_z);
+        free(surface->depth_levels[level].dirty);
+    }
+    free(surface->z);
+    free(surface->c);
+    free(surface->material);
+    free(surface->drawn);
     free(surface);
 }
 
@@ -118,65 +232,306 @@ static inline int idx_y(const struct surface *surface, float y)
     return maxi(0, mini(surface->size_y - 1, (int) floorf(y / dy)));
 }
 
-static inline float limit_y_1(const struct triangle *tri, float x)
+// Row coordinate where the edge from l to r, with l.x < x < r.x, crosses the column at x. The
+// triangles that share the edge compute it from the same end, so they get the same value.
+static inline float edge_crossing(vec3 l, vec3 r, float x)
 {
-    if (x <= tri->p1.x)
-        return tri->p1.y;
-    if (x >= tri->p3.x)
-        return tri->p3.y;
-    if (x <= tri->p2.x)
-        return tri->p1.y + (tri->p2.y - tri->p1.y) * (x - tri->p1.x) / (tri->p2.x - tri->p1.x);
-    return tri->p2.y + (tri->p3.y - tri->p2.y) * (x - tri->p2.x) / (tri->p3.x - tri->p2.x);
+    return l.y + (r.y - l.y) * (x - l.x) / (r.x - l.x);
 }
 
-static inline float limit_y_2(const struct triangle *tri, float x)
+// Rows where the edges of the triangle, sorted by x, cross the column at x: the long edge and the
+// short one that spans x.
+static inline void column_limits(const struct triangle *tri, float x, float *y_1, float *y_2)
 {
     if (x <= tri->p1.x)
-        return tri->p1.y;
+    {
+        *y_1 = *y_2 = tri->p1.y;
+        return;
+    }
     if (x >= tri->p3.x)
-        return tri->p3.y;
-    return tri->p1.y + (tri->p3.y - tri->p1.y) * (x - tri->p1.x) / (tri->p3.x - tri->p1.x);
+    {
+        *y_1 = *y_2 = tri->p3.y;
+        return;
+    }
+    *y_1 = (x <= tri->p2.x) ? edge_crossing(tri->p1, tri->p2, x) : edge_crossing(tri->p2, tri->p3, x);
+    *y_2 = edge_crossing(tri->p1, tri->p3, x);
+}
+
+// Depth over the surface as the plane z0 + zx * (x - x0) + zy * (y - y0).
+struct depth_plane
+{
+    double zx, zy;
+    double x0, y0, z0;
+};
+
+static struct depth_plane depth_plane_init(const struct triangle *tri)
+{
+    double v1x = (double) tri->p2.x - tri->p1.x;
+    double v1y = (double) tri->p2.y - tri->p1.y;
+    double v1z = (double) tri->p2.z - tri->p1.z;
+    double v2x = (double) tri->p3.x - tri->p1.x;
+    double v2y = (double) tri->p3.y - tri->p1.y;
+    double v2z = (double) tri->p3.z - tri->p1.z;
+
+    double nx = v1y * v2z - v1z * v2y;
+    double ny = v1z * v2x - v1x * v2z;
+    double nz = v1x * v2y - v1y * v2x;
+
+    struct depth_plane plane;
+    plane.zx = -nx / nz;
+    plane.zy = -ny / nz;
+    plane.x0 = tri->p1.x;
+    plane.y0 = tri->p1.y;
+    plane.z0 = tri->p1.z;
+    return plane;
+}
+
+static inline double depth_plane_at(const struct depth_plane *plane, double x, double y)
+{
+    return plane->z0 + plane->zx * (x - plane->x0) + plane->zy * (y - plane->y0);
+}
+
+// Largest depth in a tile, computed again from the pixels or the tiles of the previous level if
+// something was drawn on it.
+static float depth_tile_max(struct surface *surface, int level, unsigned int tx, unsigned int ty)
+{
+    struct depth_tiles *tiles = &surface->depth_levels[level];
+    unsigned int i = ty * tiles->size_x + tx;
+    if (!tiles->dirty[i])
+        return tiles->max_z[i];
+
+    float max_z = -INFINITY;
+    if (level == 0)
+    {
+        unsigned int xx_end = mini(surface->size_x, (tx + 1) << SURFACE_DEPTH_TILE_SHIFT_X);
+        unsigned int yy_end = mini(surface->size_y, (ty + 1) << SURFACE_DEPTH_TILE_SHIFT_Y);
+        for (unsigned int xx = tx << SURFACE_DEPTH_TILE_SHIFT_X; xx < xx_end; ++xx)
+        {
+            for (unsigned int yy = ty << SURFACE_DEPTH_TILE_SHIFT_Y; yy < yy_end; ++yy)
+                max_z = maxi(max_z, surface->z[surface_index(surface, xx, yy)]);
+        }
+    }
+    else
+    {
+        const struct depth_tiles *prev = &surface->depth_levels[level - 1];
+        for (unsigned int cy = 2 * ty; cy < mini(prev->size_y, 2 * ty + 2); ++cy)
+        {
+            for (unsigned int cx = 2 * tx; cx < mini(prev->size_x, 2 * tx + 2); ++cx)
+                max_z = maxi(max_z, depth_tile_max(surface, level - 1, cx, cy));
+        }
+    }
+
+    tiles->max_z[i] = max_z;
+    tiles->dirty[i] = false;
+    return max_z;
+}
+
+// Largest depth of the pixels in the given columns and rows, or more. Uses the finest level where
+// they span at most two tiles in each direction.
+static float depth_rect_max(struct surface *surface, int xxi, int xxf, int yyi, int yyf)
+{
+    int shift_x = SURFACE_DEPTH_TILE_SHIFT_X;
+    int shift_y = SURFACE_DEPTH_TILE_SHIFT_Y;
+    int level = 0;
+    while (level < SURFACE_DEPTH_LEVELS - 1 &&
+            ((xxf >> shift_x) - (xxi >> shift_x) > 1 || (yyf >> shift_y) - (yyi >> shift_y) > 1))
+    {
+        level++;
+        shift_x++;
+        shift_y++;
+    }
+
+    float max_z = -INFINITY;
+    for (int ty = yyi >> shift_y; ty <= yyf >> shift_y; ++ty)
+    {
+        for (int tx = xxi >> shift_x; tx <= xxf >> shift_x; ++tx)
+        {
+            max_z = maxi(max_z, depth_tile_max(surface, level, tx, ty));
+            if (max_z == INFINITY)
+                return max_z;
+        }
+    }
+    return max_z;
 }
 
-static inline float triangle_depth(const struct surface *surface, const struct triangle *tri,
-        vec3 normal, int xx, int yy)
+// Mark the tiles with the pixels in the given columns and rows as drawn. The tiles that contain a
+// drawn tile are also drawn, so the marking stops at the first one that already was.
+static void depth_mark_dirty(struct surface *surface, int xxi, int xxf, int yyi, int yyf)
 {
+    for (int ty = yyi >> SURFACE_DEPTH_TILE_SHIFT_Y; ty <= yyf >> SURFACE_DEPTH_TILE_SHIFT_Y; ++ty)
+    {
+        for (int tx = xxi >> SURFACE_DEPTH_TILE_SHIFT_X; tx <= xxf >> SURFACE_DEPTH_TILE_SHIFT_X; ++tx)
+        {
+            for (int level = 0; level < SURFACE_DEPTH_LEVELS; ++level)
+            {
+                struct depth_tiles *tiles = &surface->depth_levels[level];
+                bool *dirty = &tiles->dirty[(ty >> level) * tiles->size_x + (tx >> level)];
+                if (*dirty)
+                    break;
+                *dirty = true;
+            }
+        }
+    }
+}
+
+// Add the pixels in the given columns and rows to those drawn on their bins.
+static void mark_drawn(struct surface *surface, int xxi, int xxf, int yyi, int yyf)
+{
+    for (int by = yyi >> SURFACE_BIN_SHIFT_Y; by <= yyf >> SURFACE_BIN_SHIFT_Y; ++by)
+    {
+        for (int bx = xxi >> SURFACE_BIN_SHIFT_X; bx <= xxf >> SURFACE_BIN_SHIFT_X; ++bx)
+        {
+            struct surface_rect bin = surface_bin_rect(surface, bx, by);
+            struct surface_rect rect = {maxi(bin.xxi, xxi), mini(bin.xxf, xxf), maxi(bin.yyi, yyi),
+                    mini(bin.yyf, yyf)};
+
+            // Empty when the first column is after the last
+            struct surface_rect *drawn = &surface->drawn[by * surface->bins_x + bx];
+            if (drawn->xxi <= drawn->xxf)
+            {
+                rect.xxi = mini(rect.xxi, drawn->xxi);
+                rect.xxf = maxi(rect.xxf, drawn->xxf);
+                rect.yyi = mini(rect.yyi, drawn->yyi);
+                rect.yyf = maxi(rect.yyf, drawn->yyf);
+            }
+            *drawn = rect;
+        }
+    }
+}
+
+// Whether the triangle is behind all the pixels it could be drawn on, in the given columns and
+// rows. The depth is linear, so its minimum there is at a corner; the margin covers its rounding.
+static bool triangle_occluded(struct surface *surface, const struct depth_plane *plane,
+        int xxi, int xxf, int yyi, int yyf, struct occlusion_stats *stats)
+{
+    stats->tests++;
+
+    float max_z = depth_rect_max(surface, xxi, xxf, yyi, yyf);
+    if (max_z == INFINITY)
+        return false;
+
+    double min_depth = INFINITY;
+    double max_offset = 0;
+    int xxs[2] = {xxi, xxf};
+    int yys[2] = {yyi, yyf};
+    for (int i = 0; i < 2; ++i)
+    {
+        for (int j = 0; j < 2; ++j)
+        {
+            float x = (xxs[i] + 0.5) * surface->dx;
+            double y = (yys[j] + 0.5) * surface->dy;
+            min_depth = fmin(min_depth, depth_plane_at(plane, x, y));
+            max_offset = fmax(max_offset, fabs(plane->zx * (x - plane->x0)) +
+                    fabs(plane->zy * (y - plane->y0)));
+        }
+    }
+    min_depth -= 1e-5 * (fabs(plane->z0) + max_offset);
+
+    // Also false when the depth is not finite, for triangles seen from the side
+    if (!(min_depth >= max_z))
+        return false;
+
+    stats->rejects++;
+    return true;
+}
+
+// Signed area of the triangle on the surface, zero when it's not drawn: if it's a back face, has no
+// area or is out of the surface. Otherwise sets the rectangle of the pixels it may be drawn on.
+static double triangle_rect(const struct surface *surface, const struct triangle *tri,
+        bool inverted_orientation, struct surface_rect *rect)
+{
+    if (triangle_orientation(tri) != !inverted_orientation)
+        return 0;
+
+    double area = ((double) tri->p2.x - tri->p1.x) * ((double) tri->p3.y - tri->p1.y)
+            - ((double) tri->p2.y - tri->p1.y) * ((double) tri->p3.x - tri->p1.x);
+    if (area == 0)
+        return 0;
+
     float dx = surface->dx;
     float dy = surface->dy;
 
-    float x = (xx + 0.5) * dx;
-    float y = (yy + 0.5) * dy;
+    float x_min = mini(tri->p1.x, mini(tri->p2.x, tri->p3.x));
+    float x_max = maxi(tri->p1.x, maxi(tri->p2.x, tri->p3.x));
+    float y_min = mini(tri->p1.y, mini(tri->p2.y, tri->p3.y));
+    float y_max = maxi(tri->p1.y, maxi(tri->p2.y, tri->p3.y));
+
+    float xi = x_min + dx / 2.0;
+    float xf = x_max - dx / 2.0;
 
-    return tri->p1.z - (normal.x * (x - tri->p1.x) + normal.y * (y - tri->p1.y)) / normal.z;
+    if (xf < 0 || xi > surface->logical_size_x || y_max < 0 || y_min > surface->logical_size_y)
+        return 0;
+
+    rect->xxi = idx_x(surface, xi);
+    rect->xxf = idx_x(surface, xf);
+    // One more row on each side, since the rows of each column are rounded on their own
+    rect->yyi = maxi(0, idx_y(surface, y_min + dy / 2.0) - 1);
+    rect->yyf = mini(surface->size_y - 1, idx_y(surface, y_max - dy / 2.0) + 1);
+    return area;
+}
+
+bool surface_triangle_rect(const struct surface *surface, const struct triangle *tri,
+        bool inverted_orientation, struct surface_rect *rect)
+{
+    return triangle_rect(surface, tri, inverted_orientation, rect) != 0;
 }
 
 void surface_draw_triangle(struct surface *surface, struct triangle tri, bool inverted_orientation,
         char c, int material)
 {
-    if (triangle_orientation(&tri) != !inverted_orientation)
-        return;
+    struct surface_rect clip = {0, surface->size_x - 1, 0, surface->size_y - 1};
+    surface_draw_triangle_clipped(surface, tri, inverted_orientation, c, material, clip,
+            &surface->occlusion);
+}
 
-    vec3 normal = triangle_normal(&tri);
+void surface_draw_triangle_clipped(struct surface *surface, struct triangle tri,
+        bool inverted_orientation, char c, int material, struct surface_rect clip,
+        struct occlusion_stats *stats)
+{
+    struct surface_rect rect;
+    double area = triangle_rect(surface, &tri, inverted_orientation, &rect);
+    if (area == 0)
+        return;
 
-    tri = triangle_sort_by_x(tri);
+    int xxi = maxi(rect.xxi, clip.xxi);
+    int xxf = mini(rect.xxf, clip.xxf);
+    int yyi = maxi(rect.yyi, clip.yyi);
+    int yyf = mini(rect.yyf, clip.yyf);
+    if (xxi > xxf || yyi > yyf)
+        return;
 
     float dx = surface->dx;
     float dy = surface->dy;
 
-    float xi = tri.p1.x + dx / 2.0;
-    float xf = tri.p3.x - dx / 2.0;
+    struct depth_plane plane = depth_plane_init(&tri);
 
-    if (xf < 0 || xi > surface->logical_size_x)
-        return;
+    // Small triangles are drawn faster than tested
+    if ((xxf - xxi + 1) * (yyf - yyi + 1) >= SURFACE_OCCLUSION_MIN_AREA)
+    {
+        if (triangle_occluded(surface, &plane, xxi, xxf, yyi, yyf, stats))
+            return;
+    }
 
-    int xxi = idx_x(surface, xi);
-    int xxf = idx_x(surface, xf);
+    // The depth is linear, so it is stepped from row to row
+    double depth_step = plane.zy * dy;
+
+    // The materials past the last that fits are drawn without one
+    int16_t material_16 = (material >= 0 && material < INT16_MAX) ? material : -1;
+
+    // Rows of the pixels drawn
+    int drawn_yyi = surface->size_y;
+    int drawn_yyf = -1;
+
+    tri = triangle_sort_by_x(tri);
 
     for (int xx = xxi; xx <= xxf; ++xx)
     {
         float x = (xx + 0.5) * dx;
-        float y_1 = limit_y_1(&tri, x);
-        float y_2 = limit_y_2(&tri, x);
+
+        // The pixels with the center below the top edge and up to the bottom one are drawn, so those
+        // on an edge shared by two triangles are drawn once. Neither are those on vertical edges.
+        float y_1, y_2;
+        column_limits(&tri, x, &y_1, &y_2);
 
         float yi = mini(y_1, y_2);
         float yf = maxi(y_1, y_2);
@@ -184,23 +539,47 @@ void surface_draw_triangle(struct surface *surface, struct triangle tri, bool in
         if (yf < 0 || yi > surface->logical_size_y)
             continue;
 
-        int yyi = idx_y(surface, yi + dy / 2.0);
-        int yyf = idx_y(surface, yf - dy / 2.0);
+        // The rows are clamped to the surface, so the border rows are also drawn for the triangles
+        // that reach the surface without covering their centers
+        int yy_first = maxi(yyi, idx_y(surface, yi + dy / 2.0));
+        int yy_last = mini(yyf, idx_y(surface, yf - dy / 2.0));
+        if (yy_first > yy_last)
+            continue;
 
-        for (int yy = yyi; yy <= yyf; ++yy)
-        {
-            struct pixel *pix = &surface->pixels[yy * surface->size_x + xx];
+        double depth = depth_plane_at(&plane, x, (yy_first + 0.5) * dy);
 
-            float depth = triangle_depth(surface, &tri, normal, xx, yy);
+        // The pixels of the column are contiguous
+        unsigned int i = surface_index(surface, xx, yy_first);
+        float *z = &surface->z[i];
+        char *chars = &surface->c[i];
+        int16_t *materials = &surface->material[i];
 
-            if (depth < pix->z)
+        for (int yy = yy_first; yy <= yy_last; ++yy)
+        {
+            if ((float) depth < *z)
             {
-                pix->z = depth;
-                pix->c = c;
-                pix->material = material;
+                *z = depth;
+                *chars = c;
+                *materials = material_16;
+
+                if (yy < drawn_yyi)
+                    drawn_yyi = yy;
+                if (yy > drawn_yyf)
+                    drawn_yyf = yy;
             }
+
+            depth += depth_step;
+            z++;
+            chars++;
+            materials++;
         }
     }
+
+    if (drawn_yyf >= 0)
+    {
+        depth_mark_dirty(surface, xxi, xxf, drawn_yyi, drawn_yyf);
+        mark_drawn(surface, xxi, xxf, drawn_yyi, drawn_yyf);
+    }
 }
 
 void surface_print(FILE *fp, const struct surface *surface)
@@ -209,8 +588,8 @@ void surface_print(FILE *fp, const struct surface *surface)
     {
         for (int xx = 0; xx < surface->size_x; ++xx)
         {
-            struct pixel px = surface->pixels[yy * surface->size_x + xx];
-            int color = px.material + 1;
+            unsigned int i = surface_index(surface, xx, yy);
+            int color = surface->material[i] + 1;
 
             if (color > 0 && color < COLORS && color < COLOR_PAIRS)
             {
@@ -222,11 +601,11 @@ void surface_print(FILE *fp, const struct surface *surface)
                 int gg = (255 * (int) g)/1000;
                 int bb = (255 * (int) b)/1000;
 
-                fprintf(fp, "\x1b[38;2;%d;%d;%dm%c\x1b[0m", rr, gg, bb, px.c);
+                fprintf(fp, "\x1b[38;2;%d;%d;%dm%c\x1b[0m", rr, gg, bb, surface->c[i]);
             }
             else
             {
-                fprintf(fp, "%c", px.c);
+                fprintf(fp, "%c", surface->c[i]);
             }
         }
         fprintf(fp, "\n");
@@ -240,18 +619,18 @@ void surface_printw(const struct surface *surface)
         move(yy, 0);
         for (int xx = 0; xx < surface->size_x; ++xx)
         {
-            struct pixel px = surface->pixels[yy * surface->size_x + xx];
-            int color = px.material + 1;
+            unsigned int i = surface_index(surface, xx, yy);
+            int color = surface->material[i] + 1;
 
             if (color > 0 && color < COLORS && color < COLOR_PAIRS)
             {
                 attron(COLOR_PAIR(color));
-                printw("%c", px.c);
+                printw("%c", surface->c[i]);
                 attroff(COLOR_PAIR(color));
             }
             else
             {
-                printw("%c", px.c);
+                printw("%c", surface->c[i]);
             }
         }
     }
@@ -4,12 +4,40 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-struct pixel
+// Levels of the coarse depth buffer, each one with tiles twice as large as the previous one.
+#define SURFACE_DEPTH_LEVELS 4
+// Size in characters of the tiles of the first level, as powers of two.
+#define SURFACE_DEPTH_TILE_SHIFT_X 3
+#define SURFACE_DEPTH_TILE_SHIFT_Y 2
+
+// Size in characters of the tiles in which the triangles are binned to be drawn in parallel, as
+// powers of two. They are the tiles of the last level of the coarse depth buffer, so that the
+// threads drawing different ones don't share any of it.
+#define SURFACE_BIN_SHIFT_X (SURFACE_DEPTH_TILE_SHIFT_X + SURFACE_DEPTH_LEVELS - 1)
+#define SURFACE_BIN_SHIFT_Y (SURFACE_DEPTH_TILE_SHIFT_Y + SURFACE_DEPTH_LEVELS - 1)
+
+// Largest depth of the pixels of each tile, used to skip the triangles behind them.
+struct depth_tiles
+{
+    unsigned int size_x, size_y;
+    float *max_z;
+    // Tiles that were drawn since their depth was computed.
+    bool *dirty;
+};
+
+// Columns and rows of the surface, the last ones included.
+struct surface_rect
+{
+    int xxi, xxf, yyi, yyf;
+};
+
+// Triangles tested against the coarse depth buffer and rejected by it.
+struct occlusion_stats
 {
-    float z;
-    char c;
-    int material;
+    unsigned long long tests;
+    unsigned long long rejects;
 };
 
 struct surface
@@ -22,9 +50,28 @@ struct surface
     // Logical size of each character
     float dx, dy;
 
-    struct pixel *pixels;
+    // Depth, character and material (-1 for none) of the pixels, in separate arrays indexed by
+    // surface_index.
+    float *z;
+    char *c;
+    int16_t *material;
+
+    // Bins of the surface, and the pixels drawn on each one since the last clear.
+    unsigned int bins_x, bins_y;
+    struct surface_rect *drawn;
+
+    struct depth_tiles depth_levels[SURFACE_DEPTH_LEVELS];
+
+    // Occlusion tests since the last clear.
+    struct occlusion_stats occlusion;
 };
 
+// The pixels are stored by columns, in the order they are drawn.
+static inline unsigned int surface_index(const struct surface *surface, unsigned int xx, unsigned int yy)
+{
+    return xx * surface->size_y + yy;
+}
+
 struct triangle
 {
     union
@@ -43,11 +90,25 @@ struct surface *surface_init(unsigned int size_x, unsigned int size_y, float log
 
 void surface_free(struct surface *surface);
 
+// Clear the pixels drawn since the last clear.
 void surface_clear(struct surface *surface);
 
 void surface_draw_triangle(struct surface *surface, struct triangle tri, bool inverted_orientation,
         char c, int material);
 
+// Pixels of a bin.
+struct surface_rect surface_bin_rect(const struct surface *surface, unsigned int bx, unsigned int by);
+
+// Rectangle of the pixels on which the triangle may be drawn. False if it's not drawn at all.
+bool surface_triangle_rect(const struct surface *surface, const struct triangle *tri,
+        bool inverted_orientation, struct surface_rect *rect);
+
+// Draw only the pixels of the triangle in the rectangle, adding its occlusion tests to stats.
+// Triangles can be drawn at the same time on rectangles in different bins.
+void surface_draw_triangle_clipped(struct surface *surface, struct triangle tri,
+        bool inverted_orientation, char c, int material, struct surface_rect clip,
+        struct occlusion_stats *stats);
+
 void surface_print(FILE *fp, const struct surface *surface);
 
 void surface_printw(const struct surface *surface);
@@ -0,0 +1,209 @@
+#include "threads.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static int thread_count = 0;
+
+struct thread_call
+{
+    void (*func)(void *data, int index);
+    void *data;
+    int index;
+};
+
+void threads_set_count(int count)
+{
+    thread_count = count;
+}
+
+int threads_get_count(void)
+{
+    if (thread_count > 0)
+        return thread_count;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 0) ? (int) cpus : 1;
+}
+
+static void *thread_main(void *arg)
+{
+    struct thread_call *call = arg;
+    call->func(call->data, call->index);
+    return NULL;
+}
+
+void threads_run(int count, void (*func)(void *data, int index), void *data)
+{
+    if (count <= 1)
+    {
+        if (count == 1)
+            func(data, 0);
+        return;
+    }
+
+    pthread_t *threads;
+    struct thread_call *calls;
+
+    if (!(threads = malloc(count * sizeof(*threads))) || !(calls = malloc(count * sizeof(*calls))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < count; ++i)
+        calls[i] = (struct thread_call){.func = func, .data = data, .index = i};
+
+    for (int i = 1; i < count; ++i)
+    {
+        if (pthread_create(&threads[i], NULL, thread_main, &calls[i]) != 0)
+        {
+            fprintf(stderr, "ERROR: Failed to create thread.\n");
+            exit(1);
+        }
+    }
+
+    func(data, 0);
+
+    for (int i = 1; i < count; ++i)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    free(calls);
+}
+
+struct pool_worker
+{
+    struct thread_pool *pool;
+    pthread_t thread;
+    int index;
+    // Posted once for each call the worker has to make.
+    sem_t start;
+};
+
+struct thread_pool
+{
+    // Workers for the indexes from 1 on, allocated one by one since their threads point to them.
+    struct pool_worker **workers;
+    int workers_count;
+
+    // Current call, func is NULL to stop the workers.
+    void (*func)(void *data, int index);
+    void *data;
+    // Posted by each worker when its call ends.
+    sem_t done;
+};
+
+// Wait for the semaphore, also when a signal interrupts it.
+static void semaphore_wait(sem_t *sem)
+{
+    while (sem_wait(sem) != 0)
+        continue;
+}
+
+static void *pool_worker_main(void *arg)
+{
+    struct pool_worker *worker = arg;
+    struct thread_pool *pool = worker->pool;
+    while (true)
+    {
+        semaphore_wait(&worker->start);
+        if (!pool->func)
+            return NULL;
+
+        pool->func(pool->data, worker->index);
+        sem_post(&pool->done);
+    }
+}
+
+struct thread_pool *thread_pool_init(void)
+{
+    struct thread_pool *pool;
+    if (!(pool = malloc(sizeof(*pool))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+
+    pool->workers = NULL;
+    pool->workers_count = 0;
+    pool->func = NULL;
+    pool->data = NULL;
+    sem_init(&pool->done, 0, 0);
+    return pool;
+}
+
+static void thread_pool_grow(struct thread_pool *pool, int workers_count)
+{
+    if (!(pool->workers = realloc(pool->workers, workers_count * sizeof(*pool->workers))))
+    {
+        fprintf(stderr, "ERROR: Memory allocation failure.\n");
+        exit(1);
+    }
+
+    for (int i = pool->workers_count; i < workers_count; ++i)
+    {
+        struct pool_worker *worker;
+        if (!(worker = malloc(sizeof(*worker))))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+        worker->pool = pool;
+        worker->index = i + 1;
+        sem_init(&worker->start, 0, 0);
+
+        if (pthread_create(&worker->thread, NULL, pool_worker_main, worker) != 0)
+        {
+            fprintf(stderr, "ERROR: Failed to create thread.\n");
+            exit(1);
+        }
+        pool->workers[i] = worker;
+    }
+    pool->workers_count = workers_count;
+}
+
+void thread_pool_run(struct thread_pool *pool, int count, void (*func)(void *data, int index), void *data)
+{
+    if (count <= 1)
+    {
+        if (count == 1)
+            func(data, 0);
+        return;
+    }
+
+    if (count - 1 > pool->workers_count)
+        thread_pool_grow(pool, count - 1);
+
+    // The semaphores make the call visible to the workers, and their results to this thread
+    pool->func = func;
+    pool->data = data;
+    for (int i = 0; i < count - 1; ++i)
+        sem_post(&pool->workers[i]->start);
+
+    func(data, 0);
+
+    for (int i = 0; i < count - 1; ++i)
+        semaphore_wait(&pool->done);
+}
+
+void thread_pool_free(struct thread_pool *pool)
+{
+    pool->func = NULL;
+    for (int i = 0; i < pool->workers_count; ++i)
+        sem_post(&pool->workers[i]->start);
+
+    for (int i = 0; i < pool->workers_count; ++i)
+    {
+        pthread_join(pool->workers[i]->thread, NULL);
+        sem_destroy(&pool->workers[i]->start);
+        free(pool->workers[i]);
+    }
+    sem_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
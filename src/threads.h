@@ -0,0 +1,22 @@
+#pragma once
+
+// Set the number of worker threads, 0 means one per online CPU.
+void threads_set_count(int count);
+
+// Number of worker threads to use.
+int threads_get_count(void);
+
+// Call func(data, i) for every i in [0, count), each call in its own thread.
+// The calling thread runs the call with index 0 and returns when all calls end.
+void threads_run(int count, void (*func)(void *data, int index), void *data);
+
+// Threads kept between calls, so that they are not created for each one.
+struct thread_pool;
+
+struct thread_pool *thread_pool_init(void);
+
+// Same as threads_run, but the threads are taken from the pool, that starts more when required.
+void thread_pool_run(struct thread_pool *pool, int count, void (*func)(void *data, int index), void *data);
+
+// Stop the threads and free the pool.
+void thread_pool_free(struct thread_pool *pool);
@@ -0,0 +1,16 @@
+#include "timing.h"
+
+#include <stddef.h>
+#include <sys/time.h>
+
+unsigned long long get_current_useconds(void)
+{
+    unsigned long long ret;
+    struct timeval time;
+
+    gettimeofday(&time, NULL);
+    ret = 1000000 * time.tv_sec;
+    ret += time.tv_usec;
+
+    return ret;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+// Get current time in microseconds
+unsigned long long get_current_useconds(void);
@@ -2,8 +2,9 @@
 
 #include <assert.h>
 #include <stdbool.h>
-#include <stdio.h>
-#include <stdlib.h>
+
+// Non-convex polygons with more vertexes than this are triangularized by ear clipping.
+#define EAR_CLIPPING_MIN_VERTEXES 32
 
 static float absfloat(float a)
 {
@@ -25,148 +26,341 @@ static bool point_in_triangle(vec3 pt, vec3 v1, vec3 v2, vec3 v3)
     return a1 + a2 + a3 <= atot * 1.00001;
 }
 
-static void triangularize_recurse(vec3 *vecs, int *idxs, int n, bool orient, int *out_idxs)
+// Z component of the cross product between (v3 - v2) and (v1 - v2), its sign tells if the
+// angle at v2 is convex.
+static float corner_cross(vec3 v1, vec3 v2, vec3 v3)
 {
-    assert(n >= 3);
+    return (v3.x - v2.x) * (v1.y - v2.y) - (v3.y - v2.y) * (v1.x - v2.x);
+}
 
-    if (n == 3)
+static bool corner_is_convex(float cross_prod, bool orient)
+{
+    return cross_prod == 0 || ((cross_prod > 0) != orient);
+}
+
+// Pending polygon of triangularize_split.
+struct split_job
+{
+    vec3 *vecs;
+    int *idxs;
+    int n;
+    int *out_idxs;
+};
+
+// General triangularization: cuts ears near the middle of the polygon, but when another vertex
+// lies inside the ear, splits the polygon with a diagonal to it.
+// It uses an explicit stack of pending polygons instead of recursion.
+static void triangularize_split(vec3 *vecs, int *idxs, int n, bool orient, int *out_idxs,
+        struct arena *scratch)
+{
+    // Every split adds one pending polygon and there are at most n - 3 splits.
+    struct split_job *stack = arena_alloc(scratch, (n - 1) * sizeof(*stack));
+    int stack_size = 0;
+
+    stack[stack_size++] = (struct split_job){.vecs = vecs, .idxs = idxs, .n = n, .out_idxs = out_idxs};
+
+    while (stack_size > 0)
     {
+        struct split_job job = stack[--stack_size];
+        vecs = job.vecs;
+        idxs = job.idxs;
+        n = job.n;
+        out_idxs = job.out_idxs;
+
+        while (n > 3)
+        {
+            // Find convex angle
+            int i1, i2, i3;
+            vec3 v1, v2, v3;
+            for (int t = 0; t < n; ++t)
+            {
+                i1 = (n / 2 + t + (n - 1)) % n;
+                i2 = (n / 2 + t) % n;
+                i3 = (n / 2 + t + 1) % n;
+
+                v1 = vecs[i1];
+                v2 = vecs[i2];
+                v3 = vecs[i3];
+
+                if (corner_is_convex(corner_cross(v1, v2, v3), orient))
+                    break;
+            }
+
+            // Rect equation ax + by + c = 0 for the line between v1 and v3
+            float a = v1.y - v3.y;
+            float b = v3.x - v1.x;
+            float c = (v1.x - v3.x) * v1.y + (v3.y - v1.y) * v1.x;
+
+            // Find point inside the (v1,v2,v3) triangle with largest perpendicular distance to line (v1,v3)
+            int max_dist_k = -1;
+            float max_dist = 0;
+            for (int k = 0; k < n; k++)
+            {
+                if (k == i1 || k == i2 || k == i3)
+                    continue;
+
+                if (point_in_triangle(vecs[k], v1, v2, v3))
+                {
+                    // Perpendicular distance (multiplied by sqrt(a^2 + b^2))
+                    float dist = absfloat(a * vecs[k].x + b * vecs[k].y + c);
+
+                    if (max_dist_k == -1 || dist > max_dist)
+                    {
+                        max_dist = dist;
+                        max_dist_k = k;
+                    }
+                }
+            }
+
+            if (max_dist_k == -1)
+            {
+                // Cut this ear on i2.
+                out_idxs[0] = idxs[i1];
+                out_idxs[1] = idxs[i2];
+                out_idxs[2] = idxs[i3];
+                out_idxs += 3;
+
+                for (int r = i2 + 1; r < n; ++r)
+                {
+                    idxs[r - 1] = idxs[r];
+                    vecs[r - 1] = vecs[r];
+                }
+                n--;
+                continue;
+            }
+
+            // Create a diagonal from i2 to max_dist_k, split the problem in two.
+            int n1 = 0;
+            int n2 = 0;
+            vec3 *vecs1 = arena_alloc(scratch, n * sizeof(vec3));
+            vec3 *vecs2 = arena_alloc(scratch, n * sizeof(vec3));
+            int *idxs1 = arena_alloc(scratch, n * sizeof(int));
+            int *idxs2 = arena_alloc(scratch, n * sizeof(int));
+
+            bool side = false;
+            for (int r = 0; r < n; ++r)
+            {
+                if (r == i2 || r == max_dist_k)
+                {
+                    vecs1[n1] = vecs[r];
+                    idxs1[n1] = idxs[r];
+                    ++n1;
+                    vecs2[n2] = vecs[r];
+                    idxs2[n2] = idxs[r];
+                    ++n2;
+                    side = !side;
+                }
+                else if (side)
+                {
+                    vecs1[n1] = vecs[r];
+                    idxs1[n1] = idxs[r];
+                    ++n1;
+                }
+                else
+                {
+                    vecs2[n2] = vecs[r];
+                    idxs2[n2] = idxs[r];
+                    ++n2;
+                }
+            }
+
+            assert(n1 + n2 == n + 2);
+            stack[stack_size++] = (struct split_job){
+                .vecs = vecs2, .idxs = idxs2, .n = n2, .out_idxs = out_idxs + 3 * (n1 - 2)};
+
+            vecs = vecs1;
+            idxs = idxs1;
+            n = n1;
+        }
+
         out_idxs[0] = idxs[0];
         out_idxs[1] = idxs[1];
         out_idxs[2] = idxs[2];
-        return;
     }
+}
 
-    // Find convex angle
-    int i1, i2, i3;
-    vec3 v1, v2, v3;
-    for (int t = 0; t < n; ++t)
+// Whether the polygon is strictly convex (and not self-intersecting) with the given orientation.
+static bool polygon_is_convex(const vec3 *vecs, int n, bool orient)
+{
+    int dir_changes = 0;
+    float last_dx = 0;
+
+    for (int i = 0; i < n; ++i)
     {
-        i1 = (n / 2 + t + (n - 1)) % n;
-        i2 = (n / 2 + t) % n;
-        i3 = (n / 2 + t + 1) % n;
+        vec3 v1 = vecs[(i + n - 1) % n];
+        vec3 v2 = vecs[i];
+        vec3 v3 = vecs[(i + 1) % n];
 
-        v1 = vecs[i1];
-        v2 = vecs[i2];
-        v3 = vecs[i3];
+        float cross_prod = corner_cross(v1, v2, v3);
+        if (cross_prod == 0 || (cross_prod > 0) == orient)
+            return false;
 
-        vec3 d1 = vec3_sub(v3, v2);
-        vec3 d2 = vec3_sub(v1, v2);
-        float cross_prod = vec3_cross_product(d1, d2).z;
-        bool convex = cross_prod == 0 || ((cross_prod > 0) != orient);
+        // A simple convex polygon goes right and then left (or the other way) only once.
+        float dx = v3.x - v2.x;
+        if (dx != 0)
+        {
+            if (last_dx != 0 && (dx > 0) != (last_dx > 0))
+                dir_changes++;
+            last_dx = dx;
+        }
+    }
+
+    return dir_changes <= 2;
+}
+
+// Triangularize a convex polygon in linear time.
+// It cuts the ears in the same order as triangularize_split does for convex polygons (a zigzag
+// from the middle), so the results match, with a linked list instead of moving the array.
+static void triangularize_convex(int n, int *out_idxs, struct arena *scratch)
+{
+    if (n == 4)
+    {
+        out_idxs[0] = 1;
+        out_idxs[1] = 2;
+        out_idxs[2] = 3;
+        out_idxs[3] = 0;
+        out_idxs[4] = 1;
+        out_idxs[5] = 3;
+        return;
+    }
 
-        if (convex)
-            break;
+    int *prev = arena_alloc(scratch, n * sizeof(int));
+    int *next = arena_alloc(scratch, n * sizeof(int));
+    for (int i = 0; i < n; ++i)
+    {
+        prev[i] = (i + n - 1) % n;
+        next[i] = (i + 1) % n;
     }
 
-    // Rect equation ax + by + c = 0 for the line between v1 and v3
-    float a = v1.y - v3.y;
-    float b = v3.x - v1.x;
-    float c = (v1.x - v3.x) * v1.y + (v3.y - v1.y) * v1.x;
+    int first = 0;
+    int cursor = n / 2;
 
-    // Find point inside the (v1,v2,v3) triangle with largest perpendicular distance to line (v1,v3)
-    int max_dist_k = -1;
-    float max_dist = 0;
-    for (int k = 0; k < n; k++)
+    for (int m = n; m > 3; --m)
     {
-        if (k == i1 || k == i2 || k == i3)
-            continue;
+        int i1 = prev[cursor];
+        int i3 = next[cursor];
 
-        if (point_in_triangle(vecs[k], v1, v2, v3))
-        {
-            // Perpendicular distance (multiplied by sqrt(a^2 + b^2))
-            float dist = absfloat(a * vecs[k].x + b * vecs[k].y + c);
+        *out_idxs++ = i1;
+        *out_idxs++ = cursor;
+        *out_idxs++ = i3;
 
-            if (max_dist_k == -1 || dist > max_dist)
-            {
-                max_dist = dist;
-                max_dist_k = k;
-            }
-        }
+        next[i1] = i3;
+        prev[i3] = i1;
+        if (cursor == first)
+            first = i3;
+
+        // The middle of the remaining polygon
+        cursor = (m % 2 == 0) ? i1 : i3;
     }
 
-    if (max_dist_k == -1)
+    out_idxs[0] = first;
+    out_idxs[1] = next[first];
+    out_idxs[2] = next[next[first]];
+}
+
+// Ear clipping for large non-convex polygons. Only the reflex vertexes can be inside an ear, so
+// the cost is O(n * r), r being the number of reflex vertexes.
+static void triangularize_ear_clipping(const vec3 *vecs, int n, bool orient, int *out_idxs,
+        struct arena *scratch)
+{
+    int *prev = arena_alloc(scratch, n * sizeof(int));
+    int *next = arena_alloc(scratch, n * sizeof(int));
+    bool *reflex = arena_alloc(scratch, n * sizeof(bool));
+    int *reflex_list = arena_alloc(scratch, n * sizeof(int));
+    int reflex_count = 0;
+
+    for (int i = 0; i < n; ++i)
     {
-        // Cut this ear on i2.
-        out_idxs[0] = idxs[i1];
-        out_idxs[1] = idxs[i2];
-        out_idxs[2] = idxs[i3];
+        prev[i] = (i + n - 1) % n;
+        next[i] = (i + 1) % n;
+    }
+    for (int i = 0; i < n; ++i)
+    {
+        reflex[i] = !corner_is_convex(corner_cross(vecs[prev[i]], vecs[i], vecs[next[i]]), orient);
+        if (reflex[i])
+            reflex_list[reflex_count++] = i;
+    }
+
+    int m = n;
+    int cursor = 0;
+    // Vertexes visited since the last ear was cut, to detect (numerically) degenerate polygons.
+    int tries = 0;
 
-        int n2 = 0;
-        for (int r = 0; r < n; ++r)
+    while (m > 3)
+    {
+        int i1 = prev[cursor];
+        int i2 = cursor;
+        int i3 = next[cursor];
+
+        bool ear = !reflex[i2];
+        for (int r = 0; ear && r < reflex_count; ++r)
         {
-            if (r == i2)
+            int k = reflex_list[r];
+            if (k == i1 || k == i2 || k == i3 || !reflex[k])
+                continue;
+
+            vec3 pt = vecs[k];
+            // Repeated positions (e.g. from bridged holes) don't block the ear
+            if ((pt.x == vecs[i1].x && pt.y == vecs[i1].y) || (pt.x == vecs[i3].x && pt.y == vecs[i3].y))
                 continue;
-            idxs[n2] = idxs[r];
-            vecs[n2] = vecs[r];
-            ++n2;
+
+            if (point_in_triangle(pt, vecs[i1], vecs[i2], vecs[i3]))
+                ear = false;
         }
-        assert(n2 == n - 1);
-        triangularize_recurse(vecs, idxs, n2, orient, out_idxs + 3);
-    }
-    else
-    {
-        // Create a diagonal from i2 to max_dist_k, split the problem in two.
-        int n1 = 0;
-        int n2 = 0;
-        vec3 *vecs1 = NULL;
-        vec3 *vecs2 = NULL;
-        int *idxs1 = NULL;
-        int *idxs2 = NULL;
-
-        vecs1 = malloc(n * sizeof(vec3));
-        vecs2 = malloc(n * sizeof(vec3));
-        idxs1 = malloc(n * sizeof(int));
-        idxs2 = malloc(n * sizeof(int));
-
-        if (!vecs1 || !vecs2 || !idxs1 || !idxs2)
+
+        // If no ear was found after a full turn, cut anyway to finish.
+        if (!ear && tries < m)
         {
-            fprintf(stderr, "ERROR: Memory allocation failure.\n");
-            exit(1);
+            tries++;
+            cursor = i3;
+            continue;
         }
 
-        bool side = false;
-        for (int r = 0; r < n; ++r)
+        *out_idxs++ = i1;
+        *out_idxs++ = i2;
+        *out_idxs++ = i3;
+
+        next[i1] = i3;
+        prev[i3] = i1;
+        reflex[i2] = false;
+        m--;
+        tries = 0;
+
+        // Neighbours may become convex
+        if (reflex[i1])
+            reflex[i1] = !corner_is_convex(corner_cross(vecs[prev[i1]], vecs[i1], vecs[i3]), orient);
+        if (reflex[i3])
+            reflex[i3] = !corner_is_convex(corner_cross(vecs[i1], vecs[i3], vecs[next[i3]]), orient);
+
+        // Drop the vertexes that are not reflex anymore from the list
+        int kept = 0;
+        for (int r = 0; r < reflex_count; ++r)
         {
-            if (r == i2 || r == max_dist_k)
-            {
-                vecs1[n1] = vecs[r];
-                idxs1[n1] = idxs[r];
-                ++n1;
-                vecs2[n2] = vecs[r];
-                idxs2[n2] = idxs[r];
-                ++n2;
-                side = !side;
-            }
-            else if (side)
-            {
-                vecs1[n1] = vecs[r];
-                idxs1[n1] = idxs[r];
-                ++n1;
-            }
-            else
-            {
-                vecs2[n2] = vecs[r];
-                idxs2[n2] = idxs[r];
-                ++n2;
-            }
+            if (reflex[reflex_list[r]])
+                reflex_list[kept++] = reflex_list[r];
         }
+        reflex_count = kept;
 
-        assert(n1 + n2 == n + 2);
-        triangularize_recurse(vecs1, idxs1, n1, orient, out_idxs);
-        triangularize_recurse(vecs2, idxs2, n2, orient, out_idxs + 3 * (n1 - 2));
-
-        free(vecs1);
-        free(vecs2);
-        free(idxs1);
-        free(idxs2);
+        cursor = i1;
     }
+
+    out_idxs[0] = prev[cursor];
+    out_idxs[1] = cursor;
+    out_idxs[2] = next[cursor];
 }
 
-void triangularize(const vec3 *vecs, int n, int *out_idxs)
+void triangularize(const vec3 *vecs, int n, int *out_idxs, struct arena *scratch)
 {
     assert(n >= 3);
 
+    if (n == 3)
+    {
+        out_idxs[0] = 0;
+        out_idxs[1] = 1;
+        out_idxs[2] = 2;
+        return;
+    }
+
     // Find the plane that contains all vectors (given by <dir1,dir2>)
     float best_normal_mag = 0;
     vec3 dir1, dir2;
@@ -189,12 +383,7 @@ void triangularize(const vec3 *vecs, int n, int *out_idxs)
     }
 
     // Translate all vectors to plane coordinates
-    vec3 *vecs_plane = malloc(n * sizeof(vec3));
-    if (!vecs_plane)
-    {
-        fprintf(stderr, "ERROR: Memory allocation failure.\n");
-        exit(1);
-    }
+    vec3 *vecs_plane = arena_alloc(scratch, n * sizeof(vec3));
 
     for (int i = 0; i < n; ++i)
     {
@@ -214,19 +403,22 @@ void triangularize(const vec3 *vecs, int n, int *out_idxs)
     }
     bool orientation = area >= 0;
 
-    // Vector indexes
-    int *idxs = malloc(n * sizeof(int));
-    if (!idxs)
+    if (polygon_is_convex(vecs_plane, n, orientation))
+    {
+        triangularize_convex(n, out_idxs, scratch);
+        return;
+    }
+
+    if (n > EAR_CLIPPING_MIN_VERTEXES)
     {
-        fprintf(stderr, "ERROR: Memory allocation failure.\n");
-        exit(1);
+        triangularize_ear_clipping(vecs_plane, n, orientation, out_idxs, scratch);
+        return;
     }
+
+    // Vector indexes
+    int *idxs = arena_alloc(scratch, n * sizeof(int));
     for (int i = 0; i < n; ++i)
         idxs[i] = i;
 
-    triangularize_recurse(vecs_plane, idxs, n, orientation, out_idxs);
-    free(vecs_plane);
-    free(idxs);
-
-    return;
+    triangularize_split(vecs_plane, idxs, n, orientation, out_idxs, scratch);
 }
@@ -92,6 +92,22 @@ static inline vec3 vec3_cross_product(vec3 a, vec3 b)
     return prod;
 }
 
+// Affine transformation, the last column is the translation.
+typedef struct
+{
+    float m[3][4];
+} affine3;
+
+static inline vec3 affine3_apply(const affine3 *t, vec3 v)
+{
+    vec3 res;
+
+    res.x = t->m[0][0] * v.x + t->m[0][1] * v.y + t->m[0][2] * v.z + t->m[0][3];
+    res.y = t->m[1][0] * v.x + t->m[1][1] * v.y + t->m[1][2] * v.z + t->m[1][3];
+    res.z = t->m[2][0] * v.x + t->m[2][1] * v.y + t->m[2][2] * v.z + t->m[2][3];
+    return res;
+}
+
 vec3 get_bounding_box_center(const vec3 *A, int n);
 
 float get_max_dist(const vec3 *A, int n, vec3 p);
@@ -0,0 +1,386 @@
+#include "vertex_kernel.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VERTEX_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+// The kernels process the positions in [begin, end). While computing bounds, xz_rad holds the
+// squared radius, the square root is taken at the end.
+struct vertex_kernel
+{
+    const char *name;
+    bool (*supported)(void);
+    void (*transform)(const affine3 *t, const struct vertex_soa *in, struct vertex_soa *out,
+            unsigned int begin, unsigned int end);
+    void (*bounds)(const struct vertex_soa *soa, unsigned int begin, unsigned int end,
+            struct vertex_bounds *acc);
+};
+
+void vertex_soa_resize(struct vertex_soa *soa, unsigned int count)
+{
+    if (count > soa->capacity)
+    {
+        soa->capacity = count > 2 * soa->capacity ? count : 2 * soa->capacity;
+        if (!(soa->x = realloc(soa->x, soa->capacity * sizeof(*soa->x))) ||
+                !(soa->y = realloc(soa->y, soa->capacity * sizeof(*soa->y))) ||
+                !(soa->z = realloc(soa->z, soa->capacity * sizeof(*soa->z))))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+    }
+    soa->count = count;
+}
+
+void vertex_soa_copy(struct vertex_soa *soa, const vec3 *vertexes, unsigned int first, unsigned int count)
+{
+    vertex_soa_resize(soa, count);
+    for (unsigned int i = first; i < count; ++i)
+    {
+        soa->x[i] = vertexes[i].x;
+        soa->y[i] = vertexes[i].y;
+        soa->z[i] = vertexes[i].z;
+    }
+}
+
+void vertex_soa_free(struct vertex_soa *soa)
+{
+    free(soa->x);
+    free(soa->y);
+    free(soa->z);
+    memset(soa, 0, sizeof(*soa));
+}
+
+static bool scalar_supported(void)
+{
+    return true;
+}
+
+static void transform_scalar(const affine3 *t, const struct vertex_soa *in, struct vertex_soa *out,
+        unsigned int begin, unsigned int end)
+{
+    for (unsigned int i = begin; i < end; ++i)
+    {
+        vec3 v = affine3_apply(t, vertex_soa_get(in, i));
+        out->x[i] = v.x;
+        out->y[i] = v.y;
+        out->z[i] = v.z;
+    }
+}
+
+// Same comparisons as the min and max instructions, so that every kernel gives the same result.
+static void bounds_add(struct vertex_bounds *acc, float x, float y, float z, float xz_rad2)
+{
+    acc->min.x = x < acc->min.x ? x : acc->min.x;
+    acc->min.y = y < acc->min.y ? y : acc->min.y;
+    acc->min.z = z < acc->min.z ? z : acc->min.z;
+    acc->max.x = x > acc->max.x ? x : acc->max.x;
+    acc->max.y = y > acc->max.y ? y : acc->max.y;
+    acc->max.z = z > acc->max.z ? z : acc->max.z;
+    acc->xz_rad = xz_rad2 > acc->xz_rad ? xz_rad2 : acc->xz_rad;
+}
+
+static void bounds_scalar(const struct vertex_soa *soa, unsigned int begin, unsigned int end,
+        struct vertex_bounds *acc)
+{
+    for (unsigned int i = begin; i < end; ++i)
+    {
+        float x = soa->x[i];
+        float z = soa->z[i];
+        bounds_add(acc, x, soa->y[i], z, x * x + z * z);
+    }
+}
+
+// Add the lanes of the vector accumulators, stored in arrays.
+static void bounds_add_lanes(struct vertex_bounds *acc, int lanes, const float *min_x,
+        const float *min_y, const float *min_z, const float *max_x, const float *max_y,
+        const float *max_z, const float *xz_rad2)
+{
+    for (int k = 0; k < lanes; ++k)
+    {
+        bounds_add(acc, min_x[k], min_y[k], min_z[k], xz_rad2[k]);
+        bounds_add(acc, max_x[k], max_y[k], max_z[k], xz_rad2[k]);
+    }
+}
+
+#ifdef VERTEX_KERNEL_X86
+
+// The products and sums are done in the order of affine3_apply, without fused multiply-adds.
+
+static bool sse2_supported(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2")))
+static void transform_sse2(const affine3 *t, const struct vertex_soa *in, struct vertex_soa *out,
+        unsigned int begin, unsigned int end)
+{
+    __m128 m[3][4];
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 4; ++c)
+            m[r][c] = _mm_set1_ps(t->m[r][c]);
+    }
+
+    float *dst[3] = {out->x, out->y, out->z};
+    unsigned int i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&in->x[i]);
+        __m128 y = _mm_loadu_ps(&in->y[i]);
+        __m128 z = _mm_loadu_ps(&in->z[i]);
+        for (int r = 0; r < 3; ++r)
+        {
+            __m128 res = _mm_add_ps(_mm_mul_ps(m[r][0], x), _mm_mul_ps(m[r][1], y));
+            res = _mm_add_ps(_mm_add_ps(res, _mm_mul_ps(m[r][2], z)), m[r][3]);
+            _mm_storeu_ps(&dst[r][i], res);
+        }
+    }
+    transform_scalar(t, in, out, i, end);
+}
+
+__attribute__((target("sse2")))
+static void bounds_sse2(const struct vertex_soa *soa, unsigned int begin, unsigned int end,
+        struct vertex_bounds *acc)
+{
+    __m128 min_x = _mm_set1_ps(acc->min.x), min_y = _mm_set1_ps(acc->min.y), min_z = _mm_set1_ps(acc->min.z);
+    __m128 max_x = _mm_set1_ps(acc->max.x), max_y = _mm_set1_ps(acc->max.y), max_z = _mm_set1_ps(acc->max.z);
+    __m128 rad2 = _mm_set1_ps(acc->xz_rad);
+
+    unsigned int i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&soa->x[i]);
+        __m128 y = _mm_loadu_ps(&soa->y[i]);
+        __m128 z = _mm_loadu_ps(&soa->z[i]);
+        min_x = _mm_min_ps(x, min_x);
+        min_y = _mm_min_ps(y, min_y);
+        min_z = _mm_min_ps(z, min_z);
+        max_x = _mm_max_ps(x, max_x);
+        max_y = _mm_max_ps(y, max_y);
+        max_z = _mm_max_ps(z, max_z);
+        rad2 = _mm_max_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(z, z)), rad2);
+    }
+
+    float lanes[7][4];
+    _mm_storeu_ps(lanes[0], min_x);
+    _mm_storeu_ps(lanes[1], min_y);
+    _mm_storeu_ps(lanes[2], min_z);
+    _mm_storeu_ps(lanes[3], max_x);
+    _mm_storeu_ps(lanes[4], max_y);
+    _mm_storeu_ps(lanes[5], max_z);
+    _mm_storeu_ps(lanes[6], rad2);
+    bounds_add_lanes(acc, 4, lanes[0], lanes[1], lanes[2], lanes[3], lanes[4], lanes[5], lanes[6]);
+    bounds_scalar(soa, i, end, acc);
+}
+
+static bool avx2_supported(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+static void transform_avx2(const affine3 *t, const struct vertex_soa *in, struct vertex_soa *out,
+        unsigned int begin, unsigned int end)
+{
+    __m256 m[3][4];
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 4; ++c)
+            m[r][c] = _mm256_set1_ps(t->m[r][c]);
+    }
+
+    float *dst[3] = {out->x, out->y, out->z};
+    unsigned int i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&in->x[i]);
+        __m256 y = _mm256_loadu_ps(&in->y[i]);
+        __m256 z = _mm256_loadu_ps(&in->z[i]);
+        for (int r = 0; r < 3; ++r)
+        {
+            __m256 res = _mm256_add_ps(_mm256_mul_ps(m[r][0], x), _mm256_mul_ps(m[r][1], y));
+            res = _mm256_add_ps(_mm256_add_ps(res, _mm256_mul_ps(m[r][2], z)), m[r][3]);
+            _mm256_storeu_ps(&dst[r][i], res);
+        }
+    }
+    transform_scalar(t, in, out, i, end);
+}
+
+__attribute__((target("avx2")))
+static void bounds_avx2(const struct vertex_soa *soa, unsigned int begin, unsigned int end,
+        struct vertex_bounds *acc)
+{
+    __m256 min_x = _mm256_set1_ps(acc->min.x), min_y = _mm256_set1_ps(acc->min.y);
+    __m256 min_z = _mm256_set1_ps(acc->min.z), max_x = _mm256_set1_ps(acc->max.x);
+    __m256 max_y = _mm256_set1_ps(acc->max.y), max_z = _mm256_set1_ps(acc->max.z);
+    __m256 rad2 = _mm256_set1_ps(acc->xz_rad);
+
+    unsigned int i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&soa->x[i]);
+        __m256 y = _mm256_loadu_ps(&soa->y[i]);
+        __m256 z = _mm256_loadu_ps(&soa->z[i]);
+        min_x = _mm256_min_ps(x, min_x);
+        min_y = _mm256_min_ps(y, min_y);
+        min_z = _mm256_min_ps(z, min_z);
+        max_x = _mm256_max_ps(x, max_x);
+        max_y = _mm256_max_ps(y, max_y);
+        max_z = _mm256_max_ps(z, max_z);
+        rad2 = _mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(z, z)), rad2);
+    }
+
+    float lanes[7][8];
+    _mm256_storeu_ps(lanes[0], min_x);
+    _mm256_storeu_ps(lanes[1], min_y);
+    _mm256_storeu_ps(lanes[2], min_z);
+    _mm256_storeu_ps(lanes[3], max_x);
+    _mm256_storeu_ps(lanes[4], max_y);
+    _mm256_storeu_ps(lanes[5], max_z);
+    _mm256_storeu_ps(lanes[6], rad2);
+    bounds_add_lanes(acc, 8, lanes[0], lanes[1], lanes[2], lanes[3], lanes[4], lanes[5], lanes[6]);
+    bounds_scalar(soa, i, end, acc);
+}
+
+static bool avx512_supported(void)
+{
+    return __builtin_cpu_supports("avx512f");
+}
+
+__attribute__((target("avx512f")))
+static void transform_avx512(const affine3 *t, const struct vertex_soa *in, struct vertex_soa *out,
+        unsigned int begin, unsigned int end)
+{
+    __m512 m[3][4];
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 4; ++c)
+            m[r][c] = _mm512_set1_ps(t->m[r][c]);
+    }
+
+    float *dst[3] = {out->x, out->y, out->z};
+    unsigned int i = begin;
+    for (; i + 16 <= end; i += 16)
+    {
+        __m512 x = _mm512_loadu_ps(&in->x[i]);
+        __m512 y = _mm512_loadu_ps(&in->y[i]);
+        __m512 z = _mm512_loadu_ps(&in->z[i]);
+        for (int r = 0; r < 3; ++r)
+        {
+            __m512 res = _mm512_add_ps(_mm512_mul_ps(m[r][0], x), _mm512_mul_ps(m[r][1], y));
+            res = _mm512_add_ps(_mm512_add_ps(res, _mm512_mul_ps(m[r][2], z)), m[r][3]);
+            _mm512_storeu_ps(&dst[r][i], res);
+        }
+    }
+    transform_scalar(t, in, out, i, end);
+}
+
+__attribute__((target("avx512f")))
+static void bounds_avx512(const struct vertex_soa *soa, unsigned int begin, unsigned int end,
+        struct vertex_bounds *acc)
+{
+    __m512 min_x = _mm512_set1_ps(acc->min.x), min_y = _mm512_set1_ps(acc->min.y);
+    __m512 min_z = _mm512_set1_ps(acc->min.z), max_x = _mm512_set1_ps(acc->max.x);
+    __m512 max_y = _mm512_set1_ps(acc->max.y), max_z = _mm512_set1_ps(acc->max.z);
+    __m512 rad2 = _mm512_set1_ps(acc->xz_rad);
+
+    unsigned int i = begin;
+    for (; i + 16 <= end; i += 16)
+    {
+        __m512 x = _mm512_loadu_ps(&soa->x[i]);
+        __m512 y = _mm512_loadu_ps(&soa->y[i]);
+        __m512 z = _mm512_loadu_ps(&soa->z[i]);
+        min_x = _mm512_min_ps(x, min_x);
+        min_y = _mm512_min_ps(y, min_y);
+        min_z = _mm512_min_ps(z, min_z);
+        max_x = _mm512_max_ps(x, max_x);
+        max_y = _mm512_max_ps(y, max_y);
+        max_z = _mm512_max_ps(z, max_z);
+        rad2 = _mm512_max_ps(_mm512_add_ps(_mm512_mul_ps(x, x), _mm512_mul_ps(z, z)), rad2);
+    }
+
+    float lanes[7][16];
+    _mm512_storeu_ps(lanes[0], min_x);
+    _mm512_storeu_ps(lanes[1], min_y);
+    _mm512_storeu_ps(lanes[2], min_z);
+    _mm512_storeu_ps(lanes[3], max_x);
+    _mm512_storeu_ps(lanes[4], max_y);
+    _mm512_storeu_ps(lanes[5], max_z);
+    _mm512_storeu_ps(lanes[6], rad2);
+    bounds_add_lanes(acc, 16, lanes[0], lanes[1], lanes[2], lanes[3], lanes[4], lanes[5], lanes[6]);
+    bounds_scalar(soa, i, end, acc);
+}
+
+#endif
+
+// From the best to the worst.
+static const struct vertex_kernel KERNELS[] = {
+#ifdef VERTEX_KERNEL_X86
+    {"avx512", avx512_supported, transform_avx512, bounds_avx512},
+    {"avx2", avx2_supported, transform_avx2, bounds_avx2},
+    {"sse2", sse2_supported, transform_sse2, bounds_sse2},
+#endif
+    {"scalar", scalar_supported, transform_scalar, bounds_scalar},
+};
+
+static const struct vertex_kernel *kernel = NULL;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void kernel_select_best(void)
+{
+    if (!kernel)
+        vertex_kernel_select(NULL);
+}
+
+static const struct vertex_kernel *kernel_get(void)
+{
+    pthread_once(&kernel_once, kernel_select_best);
+    return kernel;
+}
+
+bool vertex_kernel_select(const char *name)
+{
+    for (size_t k = 0; k < sizeof(KERNELS) / sizeof(*KERNELS); ++k)
+    {
+        if (name && strcmp(KERNELS[k].name, name) != 0)
+            continue;
+        if (KERNELS[k].supported())
+        {
+            kernel = &KERNELS[k];
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *vertex_kernel_name(void)
+{
+    return kernel_get()->name;
+}
+
+void vertex_kernel_transform(const affine3 *t, const struct vertex_soa *in, struct vertex_soa *out)
+{
+    vertex_soa_resize(out, in->count);
+    kernel_get()->transform(t, in, out, 0, in->count);
+}
+
+struct vertex_bounds vertex_kernel_bounds(const struct vertex_soa *soa)
+{
+    struct vertex_bounds bounds;
+    bounds.min = (vec3){INFINITY, INFINITY, INFINITY};
+    bounds.max = (vec3){-INFINITY, -INFINITY, -INFINITY};
+    bounds.xz_rad = 0;
+
+    kernel_get()->bounds(soa, 0, soa->count, &bounds);
+    bounds.xz_rad = sqrtf(bounds.xz_rad);
+    return bounds;
+}
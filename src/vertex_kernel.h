@@ -0,0 +1,48 @@
+#pragma once
+
+#include "trigonometry.h"
+
+#include <stdbool.h>
+
+// Positions stored as separate arrays of X, Y and Z, so that the kernels below can process
+// several vertexes at once. A zeroed struct is empty.
+struct vertex_soa
+{
+    unsigned int count;
+    unsigned int capacity;
+    float *x, *y, *z;
+};
+
+struct vertex_bounds
+{
+    vec3 min, max;
+    // Largest distance to the Y axis.
+    float xz_rad;
+};
+
+// Set the number of positions, the existing ones are kept.
+void vertex_soa_resize(struct vertex_soa *soa, unsigned int count);
+
+// Copy the vertexes from first on, resizing the arrays to count.
+void vertex_soa_copy(struct vertex_soa *soa, const vec3 *vertexes, unsigned int first, unsigned int count);
+
+void vertex_soa_free(struct vertex_soa *soa);
+
+static inline vec3 vertex_soa_get(const struct vertex_soa *soa, unsigned int i)
+{
+    return (vec3){soa->x[i], soa->y[i], soa->z[i]};
+}
+
+// Select the kernels by name: "scalar", "sse2", "avx2" or "avx512", NULL for the best one the CPU
+// supports. Returns false if the name is unknown or not supported. Call it before using the kernels.
+bool vertex_kernel_select(const char *name);
+
+// Name of the kernels in use.
+const char *vertex_kernel_name(void);
+
+// Apply the transformation to the positions of in, resizing out to hold them.
+// All the kernels give the same result as affine3_apply, bit by bit.
+void vertex_kernel_transform(const affine3 *t, const struct vertex_soa *in, struct vertex_soa *out);
+
+// Bounds of the positions, that must not be empty.
+struct vertex_bounds vertex_kernel_bounds(const struct vertex_soa *soa);
@@ -1,12 +1,18 @@
 #include "surface.h"
+#include "cluster.h"
+#include "compact_model.h"
+#include "loader.h"
+#include "lod.h"
 #include "model.h"
+#include "raster_bins.h"
+#include "render_thread.h"
+#include "threads.h"
+#include "timing.h"
 
-#include <ctype.h>
 #include <errno.h>
 #include <ncurses.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -14,6 +20,9 @@ static char *DEFAULT_LUM_OPTIONS = ".,':;!+*=#$@";
 static const float PI = 3.1415926536;
 static const float GOLDEN_RATIO = 1.6180339887;
 
+// Wait between checks of a model that is being loaded.
+static const unsigned int LOAD_POLL_USECONDS = 10000;
+
 static const float INTERACTIVE_ZOOM_MIN = 5;
 static const float INTERACTIVE_ZOOM_MAX = 1000;
 
@@ -45,6 +54,11 @@ static void output_usage(int argc, char *argv[])
     printf("  -YZX, -ZXY, -ZYX  \n");
     printf("  -F                Flip faces. \n");
     printf("  -z <zoom>         Change zoom level (default: 100).\n");
+    printf("  -j <threads>      Number of threads to load and draw (default: number of CPUs).\n");
+    printf("\n");
+    printf("  --weld            Merge vertexes with the same position (default for STL).\n");
+    printf("  --no-weld         Don't merge vertexes with the same position.\n");
+    printf("  --no-cache        Don't use the cache of preprocessed models.\n");
     printf("\n");
     printf("  --color           Display with colors.\n");
     printf("                    The OBJ format relies on the companion MTL files.\n");
@@ -57,6 +71,15 @@ static void output_usage(int argc, char *argv[])
     printf("                    Alt-controls: H, J, K, L, A, S\n");
     printf("                    Quit: Q    Toggle Hud: T\n");
     printf("\n");
+    printf("  --progressive     Start showing the model while it is being loaded.\n");
+    printf("  --compact         Keep the model with 16-bit quantized positions, using about\n");
+    printf("                    half the memory.\n");
+    printf("  --lod             Draw simplified versions of the model when its details are\n");
+    printf("                    smaller than the characters.\n");
+    printf("  --simd <isa>      Vertex kernels to use: scalar, sse2, avx2 or avx512\n");
+    printf("                    (default: the best supported by the CPU).\n");
+    printf("  --stats           Print model loading statistics to stderr.\n");
+    printf("\n");
     printf("  -?, --help        Give this help list\n");
     printf("\n");
 
@@ -87,6 +110,9 @@ struct arguments
     bool axes_flip_faces;
     bool flip_faces;
 
+    bool weld, no_weld;
+    bool use_cache;
+
     bool color_support;
 
     bool snap_mode;
@@ -95,6 +121,12 @@ struct arguments
 
     bool interactive;
 
+    int threads;
+    bool progressive;
+    bool compact;
+    bool lod;
+    bool stats;
+
     int arg_num;
     char *input_file;
 };
@@ -209,6 +241,17 @@ static void parse_arguments(int argc, char *argv[], struct arguments *args)
                 exit(1);
             }
         }
+        else if (!strcmp(argv[i], "-j"))
+        {
+            if (i >= argc - 1)
+                output_usage(argc, argv);
+            args->threads = strtol(argv[++i], NULL, 10);
+            if (errno || args->threads <= 0)
+            {
+                fprintf(stderr, "ERROR: Invalid number of threads: %s\n", argv[i]);
+                exit(1);
+            }
+        }
         else if (!strcmp(argv[i], "-XYZ"))
         {
             args->axes[0] = 0;
@@ -255,6 +298,18 @@ static void parse_arguments(int argc, char *argv[], struct arguments *args)
         {
             args->flip_faces = true;
         }
+        else if (!strcmp(argv[i], "--weld"))
+        {
+            args->weld = true;
+        }
+        else if (!strcmp(argv[i], "--no-weld"))
+        {
+            args->no_weld = true;
+        }
+        else if (!strcmp(argv[i], "--no-cache"))
+        {
+            args->use_cache = false;
+        }
         else if (!strcmp(argv[i], "--color"))
         {
             args->color_support = true;
@@ -281,6 +336,32 @@ static void parse_arguments(int argc, char *argv[], struct arguments *args)
         {
             args->interactive = true;
         }
+        else if (!strcmp(argv[i], "--progressive"))
+        {
+            args->progressive = true;
+        }
+        else if (!strcmp(argv[i], "--compact"))
+        {
+            args->compact = true;
+        }
+        else if (!strcmp(argv[i], "--lod"))
+        {
+            args->lod = true;
+        }
+        else if (!strcmp(argv[i], "--simd"))
+        {
+            if (i >= argc - 1)
+                output_usage(argc, argv);
+            if (!vertex_kernel_select(argv[++i]))
+            {
+                fprintf(stderr, "ERROR: Vertex kernels not available: %s\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (!strcmp(argv[i], "--stats"))
+        {
+            args->stats = true;
+        }
         else if (argv[i][0] == '-')
         {
             fprintf(stderr, "ERROR: Invalid option: %s\n", argv[i]);
@@ -301,19 +382,6 @@ static void parse_arguments(int argc, char *argv[], struct arguments *args)
         output_usage(argc, argv);
 }
 
-// Get current time in microseconds
-unsigned long long get_current_useconds(void)
-{
-    unsigned long long ret;
-    struct timeval time;
-
-    gettimeofday(&time, NULL);
-    ret = 1000000 * time.tv_sec;
-    ret += time.tv_usec;
-
-    return ret;
-}
-
 // Wait until frame ends function
 static void tick(unsigned long long *last_target, unsigned long long frame_duration)
 {
@@ -335,15 +403,6 @@ static void tick(unsigned long long *last_target, unsigned long long frame_durat
     }
 }
 
-// Translate from the [-1,1]^3 cube to the screen surface.
-static vec3 vec3_to_surface(const struct surface *surface, vec3 v, float zoom)
-{
-    v.x = 0.5 * surface->logical_size_x + 0.5 * v.x * zoom;
-    v.y = 0.5 * surface->logical_size_y - 0.5 * v.y * zoom;
-    v.z = 0.5 + 0.5 * v.z * zoom;
-    return v;
-}
-
 static char char_from_normal(vec3 normal, vec3 light_normal, const char *lum_chars, int lum_count)
 {
     float sim = vec3_cos_similarity(normal, light_normal, 1.0, 1.0) * 0.5 + 0.5;
@@ -399,9 +458,243 @@ static void terminal_init_colors(const struct model *model)
     }
 }
 
-static void surface_draw_model(struct surface *surface, const struct model *model, float azimuth,
-        float altitude, float zoom, bool static_light, const char *lum_chars, bool color_support)
+// Parameters of the frame being drawn.
+static vec3 light_direction(bool static_light)
+{
+    vec3 light = static_light ? (vec3){0.75, -1.0, -0.5} : (vec3){1, -1, 0};
+    return vec3_normalize(light);
+}
+
+// Character for a face with the given normal, rotated as the model but before the surface mapping.
+// The normal on the surface, where the Y axis is flipped, is (-x, y, -z).
+static char char_from_view_normal(vec3 normal, vec3 light_normal, const char *lum_chars, int lum_count)
+{
+    return char_from_normal((vec3){normal.x, -normal.y, normal.z}, light_normal, lum_chars, lum_count);
+}
+
+// Compute what doesn't change between frames for the vertexes from first_vertex and the faces from
+// first_face on: the positions for the vertex kernels, the normals and, with the static light, the
+// characters of the faces.
+static void prepare_model(struct model *model, unsigned int first_vertex, unsigned int first_face,
+        const struct arguments *args)
+{
+    model_compute_soa(model, first_vertex);
+    model_compute_normals(model, first_face);
+    model_compute_clusters(model, first_face);
+
+    if (args->static_light && model->faces_count > 0)
+    {
+        if (!(model->static_chars = realloc(model->static_chars, model->faces_count)))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+
+        vec3 light = light_direction(true);
+        int lum_count = strlen(args->lum_chars);
+        for (unsigned int f = first_face; f < model->faces_count; ++f)
+        {
+            model->static_chars[f] = char_from_view_normal(model->normals[f], light, args->lum_chars,
+                    lum_count);
+        }
+    }
+}
+
+// Memory reused between frames.
+struct draw_buffers
+{
+    // Vertexes of the model on the surface
+    struct vertex_soa vertexes;
+
+    // Frame in which each vertex was transformed, when only the visible ones are
+    unsigned int *vertex_frames;
+    unsigned int vertex_frames_capacity;
+    unsigned int frame;
+
+    // Clusters to draw in the frame
+    unsigned int *clusters;
+    unsigned int clusters_capacity;
+
+    // Triangles of the frame, drawn in parallel
+    struct raster_bins bins;
+
+    // Triangles tested against the coarse depth buffer and rejected by it, in all the frames
+    unsigned long long occlusion_tests;
+    unsigned long long occlusion_rejects;
+};
+
+static void *draw_buffers_grow(void *array, unsigned int *capacity, unsigned int count, size_t size)
+{
+    if (count > *capacity)
+    {
+        *capacity = count;
+        if (!(array = realloc(array, count * size)))
+        {
+            fprintf(stderr, "ERROR: Memory allocation failure.\n");
+            exit(1);
+        }
+    }
+    return array;
+}
+
+static void draw_buffers_free(struct draw_buffers *buffers)
+{
+    vertex_soa_free(&buffers->vertexes);
+    free(buffers->vertex_frames);
+    free(buffers->clusters);
+    raster_bins_free(&buffers->bins);
+}
+
+// Transformation from the model to the surface in a single matrix: rotation by the azimuth and
+// the altitude, then translation from the [-1,1]^3 cube to the screen surface.
+static affine3 surface_transform(const struct surface *surface, float az_cos, float az_sin,
+        float alt_cos, float alt_sin, float zoom)
+{
+    float h = 0.5 * zoom;
+    affine3 t = {{
+        {h * az_cos, 0, -h * az_sin, 0.5 * surface->logical_size_x},
+        {h * alt_sin * az_sin, -h * alt_cos, h * alt_sin * az_cos, 0.5 * surface->logical_size_y},
+        {h * alt_cos * az_sin, h * alt_sin, h * alt_cos * az_cos, 0.5},
+    }};
+    return t;
+}
+
+// Whether a sphere of the model may cover part of the surface, with a character of margin for
+// the rounding. The transformation scales lengths by 0.5 * zoom.
+static bool sphere_on_surface(const struct surface *surface, const affine3 *transform, float zoom,
+        vec3 center, float radius)
+{
+    vec3 c = affine3_apply(transform, center);
+    float r = 0.5 * zoom * radius;
+
+    return c.x + r >= -surface->dx && c.x - r <= surface->logical_size_x + surface->dx &&
+            c.y + r >= -surface->dy && c.y - r <= surface->logical_size_y + surface->dy;
+}
+
+// Find the clusters that are on the surface and have front faces, in their order, walking down
+// their hierarchy only where it is visible. Returns the number of clusters found.
+static unsigned int find_visible_clusters(struct draw_buffers *buffers, const struct surface *surface,
+        const struct face_cluster *clusters, unsigned int clusters_count,
+        const struct cluster_node *nodes, unsigned int nodes_count, const affine3 *transform,
+        float zoom, vec3 view_direction)
+{
+    buffers->clusters = draw_buffers_grow(buffers->clusters, &buffers->clusters_capacity,
+            clusters_count, sizeof(*buffers->clusters));
+
+    unsigned int count = 0;
+    unsigned int i = 0;
+    while (i < nodes_count)
+    {
+        const struct cluster_node *node = &nodes[i];
+        if (!sphere_on_surface(surface, transform, zoom, node->center, node->radius))
+        {
+            i = node->skip;
+            continue;
+        }
+
+        if (node->end_cluster - node->first_cluster == 1 &&
+                !face_cluster_is_back(&clusters[node->first_cluster], view_direction))
+        {
+            buffers->clusters[count++] = node->first_cluster;
+        }
+        i++;
+    }
+    return count;
+}
+
+// Transform only the vertexes of the faces of the visible clusters, of the compact model if it's
+// not NULL. The results are the same as when all of them are transformed.
+static void transform_visible_vertexes(struct draw_buffers *buffers, const affine3 *transform,
+        const struct model *model, const struct compact_model *compact,
+        const struct face_cluster *clusters, unsigned int visible_count)
 {
+    unsigned int vertex_count = compact ? compact->vertex_count : model->vertex_count;
+    unsigned int capacity = buffers->vertex_frames_capacity;
+
+    buffers->vertex_frames = draw_buffers_grow(buffers->vertex_frames, &buffers->vertex_frames_capacity,
+            vertex_count, sizeof(*buffers->vertex_frames));
+    if (buffers->vertex_frames_capacity > capacity)
+    {
+        memset(buffers->vertex_frames + capacity, 0,
+                (buffers->vertex_frames_capacity - capacity) * sizeof(*buffers->vertex_frames));
+    }
+    if (++buffers->frame == 0)
+    {
+        memset(buffers->vertex_frames, 0,
+                buffers->vertex_frames_capacity * sizeof(*buffers->vertex_frames));
+        buffers->frame = 1;
+    }
+    vertex_soa_resize(&buffers->vertexes, vertex_count);
+
+    for (unsigned int j = 0; j < visible_count; ++j)
+    {
+        const struct face_cluster *cluster = &clusters[buffers->clusters[j]];
+        for (unsigned int f = cluster->first_face; f < cluster->end_face; ++f)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                unsigned int i = compact ? compact_model_idx(compact, 3 * f + k)
+                        : model->faces[f].idxs[k];
+                if (buffers->vertex_frames[i] == buffers->frame)
+                    continue;
+                buffers->vertex_frames[i] = buffers->frame;
+
+                vec3 v = compact ? compact_model_vertex(compact, i) : vertex_soa_get(&model->soa, i);
+                v = affine3_apply(transform, v);
+                buffers->vertexes.x[i] = v.x;
+                buffers->vertexes.y[i] = v.y;
+                buffers->vertexes.z[i] = v.z;
+            }
+        }
+    }
+}
+
+// Transform all the vertexes, of the compact model if it's not NULL.
+static void transform_all_vertexes(struct draw_buffers *buffers, const affine3 *transform,
+        const struct model *model, const struct compact_model *compact)
+{
+    struct vertex_soa *vertexes = &buffers->vertexes;
+    if (!compact)
+    {
+        vertex_kernel_transform(transform, &model->soa, vertexes);
+        return;
+    }
+
+    // Decoded and transformed in place
+    vertex_soa_resize(vertexes, compact->vertex_count);
+    for (unsigned int i = 0; i < compact->vertex_count; ++i)
+    {
+        vec3 v = compact_model_vertex(compact, i);
+        vertexes->x[i] = v.x;
+        vertexes->y[i] = v.y;
+        vertexes->z[i] = v.z;
+    }
+    vertex_kernel_transform(transform, vertexes, vertexes);
+}
+
+// The surface is cleared before each frame, so its counts are of the frame.
+static void add_occlusion_stats(struct draw_buffers *buffers, const struct surface *surface)
+{
+    buffers->occlusion_tests += surface->occlusion.tests;
+    buffers->occlusion_rejects += surface->occlusion.rejects;
+}
+
+// Draw the model, or its compact copy if it's not NULL. If lod is not NULL, its least detailed
+// level that differs from the model less than a character is drawn instead.
+static void surface_draw_model(struct surface *surface, struct draw_buffers *buffers,
+        const struct model *model, const struct compact_model *compact, const struct lod_chain *lod,
+        float azimuth, float altitude, float zoom, bool static_light, const char *lum_chars,
+        bool color_support)
+{
+    if (lod)
+    {
+        // Model units are scaled by 0.5 * zoom on the surface, as in surface_transform
+        float max_error = fminf(surface->dx, surface->dy) / (0.5 * zoom);
+        model = lod_chain_select(lod, max_error);
+        if (model != lod->levels[0])
+            compact = NULL;
+    }
+
     int lum_count = strlen(lum_chars);
 
     float alt_cos = cosf(-altitude);
@@ -410,59 +703,124 @@ static void surface_draw_model(struct surface *surface, const struct model *mode
     float az_cos = cosf(azimuth);
     float az_sin = sinf(azimuth);
 
-    vec3 light = static_light ? (vec3){0.75, -1.0, -0.5} : (vec3){1, -1, 0};
-    light = vec3_normalize(light);
+    vec3 light = light_direction(static_light);
 
-    for (int f = 0; f < model->faces_count; ++f)
-    {
-        int i1 = model->faces[f].idxs[0];
-        int i2 = model->faces[f].idxs[1];
-        int i3 = model->faces[f].idxs[2];
+    affine3 transform = surface_transform(surface, az_cos, az_sin, alt_cos, alt_sin, zoom);
 
-        vec3 v1 = model->vertexes[i1];
-        vec3 v2 = model->vertexes[i2];
-        vec3 v3 = model->vertexes[i3];
+    // Direction of the camera in model space, the faces with normals pointing along it are hidden
+    vec3 view_direction = {alt_cos * az_sin, alt_sin, alt_cos * az_cos};
 
-        struct triangle tri = {.p1 = v1, .p2 = v2, .p3 = v3};
+    const struct face_cluster *clusters = compact ? compact->clusters : model->clusters;
+    unsigned int faces_count = compact ? compact->faces_count : model->faces_count;
+
+    unsigned int visible_count;
+    if (compact)
+    {
+        visible_count = find_visible_clusters(buffers, surface, clusters, compact->clusters_count,
+                compact->cluster_nodes, compact->cluster_nodes_count, &transform, zoom, view_direction);
+    }
+    else
+    {
+        visible_count = find_visible_clusters(buffers, surface, clusters, model->clusters_count,
+                model->cluster_nodes, model->cluster_nodes_count, &transform, zoom, view_direction);
+    }
 
-        tri.p1 = vec3_rotate_y(az_cos, az_sin, tri.p1);
-        tri.p2 = vec3_rotate_y(az_cos, az_sin, tri.p2);
-        tri.p3 = vec3_rotate_y(az_cos, az_sin, tri.p3);
+    // When zoomed in, most of the vertexes are out of view
+    unsigned int visible_faces = 0;
+    for (unsigned int j = 0; j < visible_count; ++j)
+    {
+        const struct face_cluster *cluster = &clusters[buffers->clusters[j]];
+        visible_faces += cluster->end_face - cluster->first_face;
+    }
+    if (visible_faces < faces_count / 4)
+        transform_visible_vertexes(buffers, &transform, model, compact, clusters, visible_count);
+    else
+        transform_all_vertexes(buffers, &transform, model, compact);
 
-        tri.p1 = vec3_rotate_x(alt_cos, alt_sin, tri.p1);
-        tri.p2 = vec3_rotate_x(alt_cos, alt_sin, tri.p2);
-        tri.p3 = vec3_rotate_x(alt_cos, alt_sin, tri.p3);
+    const struct vertex_soa *vertexes = &buffers->vertexes;
 
-        tri.p1 = vec3_to_surface(surface, tri.p1, zoom);
-        tri.p2 = vec3_to_surface(surface, tri.p2, zoom);
-        tri.p3 = vec3_to_surface(surface, tri.p3, zoom);
+    struct raster_bins *bins = &buffers->bins;
+    raster_bins_begin(bins, surface, threads_get_count());
 
-        char c;
-        if (static_light)
+    if (compact)
+    {
+        // Run of faces with the same material of the current face
+        unsigned int r = 0;
+        for (unsigned int j = 0; j < visible_count; ++j)
         {
-            struct triangle tri_ini = {.p1 = v1, .p2 = v2, .p3 = v3};
-            tri_ini.p1 = vec3_to_surface(surface, tri_ini.p1, zoom);
-            tri_ini.p2 = vec3_to_surface(surface, tri_ini.p2, zoom);
-            tri_ini.p3 = vec3_to_surface(surface, tri_ini.p3, zoom);
-
-            c = char_from_normal(vec3_neg(triangle_normal(&tri_ini)), light, lum_chars, lum_count);
+            const struct face_cluster *cluster = &clusters[buffers->clusters[j]];
+            for (unsigned int f = cluster->first_face; f < cluster->end_face; ++f)
+            {
+                while (compact->runs[r].end_face <= f)
+                    r++;
+                int material = color_support ? compact->runs[r].material : -1;
+
+                unsigned int i1 = compact_model_idx(compact, 3 * f);
+                unsigned int i2 = compact_model_idx(compact, 3 * f + 1);
+                unsigned int i3 = compact_model_idx(compact, 3 * f + 2);
+
+                struct triangle tri = {.p1 = vertex_soa_get(vertexes, i1),
+                        .p2 = vertex_soa_get(vertexes, i2), .p3 = vertex_soa_get(vertexes, i3)};
+
+                // The compact model doesn't keep the normals
+                char c;
+                if (static_light)
+                {
+                    vec3 v1 = compact_model_vertex(compact, i1);
+                    vec3 v2 = compact_model_vertex(compact, i2);
+                    vec3 v3 = compact_model_vertex(compact, i3);
+                    vec3 normal = vec3_normalize(vec3_cross_product(vec3_sub(v2, v1), vec3_sub(v3, v1)));
+                    c = char_from_view_normal(normal, light, lum_chars, lum_count);
+                }
+                else
+                    c = char_from_normal(vec3_neg(triangle_normal(&tri)), light, lum_chars, lum_count);
+
+                raster_bins_add(bins, tri, true, c, material);
+            }
         }
-        else
+    }
+    else
+    {
+        for (unsigned int j = 0; j < visible_count; ++j)
         {
-            c = char_from_normal(vec3_neg(triangle_normal(&tri)), light, lum_chars, lum_count);
+            const struct face_cluster *cluster = &clusters[buffers->clusters[j]];
+            for (unsigned int f = cluster->first_face; f < cluster->end_face; ++f)
+            {
+                const unsigned int *idxs = model->faces[f].idxs;
+                struct triangle tri = {.p1 = vertex_soa_get(vertexes, idxs[0]),
+                        .p2 = vertex_soa_get(vertexes, idxs[1]), .p3 = vertex_soa_get(vertexes, idxs[2])};
+
+                char c;
+                if (model->static_chars)
+                    c = model->static_chars[f];
+                else
+                {
+                    vec3 normal = vec3_rotate_y(az_cos, az_sin, model->normals[f]);
+                    normal = vec3_rotate_x(alt_cos, alt_sin, normal);
+                    c = char_from_view_normal(normal, light, lum_chars, lum_count);
+                }
+
+                raster_bins_add(bins, tri, true, c, color_support ? model->faces[f].material : -1);
+            }
         }
-
-        surface_draw_triangle(surface, tri, true, c, color_support ? model->faces[f].material : -1);
     }
+
+    raster_bins_draw(bins);
+    add_occlusion_stats(buffers, surface);
 }
 
 // Model radius only in X and Z.
 static float model_xz_rad(const struct model *model)
+{
+    return model_bounds(model).xz_rad;
+}
+
+static float compact_model_xz_rad(const struct compact_model *compact)
 {
     float rad = 0.0;
-    for (int i = 0; i < model->vertex_count; ++i)
+    for (unsigned int i = 0; i < compact->vertex_count; ++i)
     {
-        vec3 v = model->vertexes[i];
+        vec3 v = compact_model_vertex(compact, i);
 
         float dist_xz = sqrtf(v.x * v.x + v.z * v.z);
         if (dist_xz > rad)
@@ -471,12 +829,13 @@ static float model_xz_rad(const struct model *model)
     return rad;
 }
 
-static struct surface *create_surface(const struct model *model, int arg_surface_w, int arg_surface_h,
+// Surface for a model with the given radius in X and Z.
+static struct surface *create_surface(float xz_rad, int arg_surface_w, int arg_surface_h,
         float char_aspect_ratio, bool stretch)
 {
     // Logical size required by the model
     float required_y = 1.0;
-    float required_x = model_xz_rad(model);
+    float required_x = xz_rad;
     // Surface logical size
     float surface_size_x, surface_size_y;
     // Surface size in characters
@@ -514,26 +873,186 @@ static struct surface *create_surface(const struct model *model, int arg_surface
     return surface_init(surface_w, surface_h, surface_size_x, surface_size_y);
 }
 
-void init_file_extension(char dst[5], const char *filename)
+static void print_load_stats(const struct model *model, const struct compact_model *compact)
 {
-    for (int i = 0; i < 5; ++i)
-        dst[i] = '\0';
+    const struct model_load_stats *stats = &model->load_stats;
 
-    const char *ext = strrchr(filename, '.');
-    if (!ext || ext == filename)
-        return;
-    ext++;
+    double megabytes = stats->file_bytes / 1e6;
+    double seconds = stats->parse_useconds / 1e6;
+
+    if (stats->from_cache)
+        fprintf(stderr, "NOTE: Mapped %.2f MB from the cache in %.3f s.\n", megabytes, seconds);
+    else
+        fprintf(stderr, "NOTE: Parsed %.2f MB in %.3f s (%.1f MB/s).\n", megabytes, seconds,
+                seconds > 0 ? megabytes / seconds : 0.0);
+    if (stats->compressed_bytes > 0)
+        fprintf(stderr, "NOTE: Decompressed from %.2f MB.\n", stats->compressed_bytes / 1e6);
+    if (!stats->from_cache)
+        fprintf(stderr, "NOTE: %llu memory allocations while loading.\n", stats->allocations);
+    if (stats->welded_vertexes > 0)
+        fprintf(stderr, "NOTE: Welded %u duplicated vertexes.\n", stats->welded_vertexes);
+    fprintf(stderr, "NOTE: Loaded %u vertexes and %u faces.\n",
+            compact ? compact->vertex_count : model->vertex_count,
+            compact ? compact->faces_count : model->faces_count);
+    fprintf(stderr, "NOTE: Using the %s vertex kernels.\n", vertex_kernel_name());
+}
+
+// Wait until the bounds of the model being loaded are estimated, returns the model made of the
+// sampled positions, or NULL if the loading finished first.
+static struct model *wait_load_bounds(struct load_job *job)
+{
+    struct model *bounds;
+    while (!(bounds = load_job_bounds_model(job)))
+    {
+        if (load_job_finished(job))
+            return NULL;
+        usleep(LOAD_POLL_USECONDS);
+    }
+    return bounds;
+}
+
+// Simplified versions of the model, to draw with less detail when it's small.
+static struct lod_chain *make_lod_chain(struct model *model, const struct arguments *args, bool stats)
+{
+    struct lod_chain *lod = lod_chain_init(model);
+    for (int i = 1; i < lod->levels_count; ++i)
+        prepare_model(lod->levels[i], 0, 0, args);
 
-    for (int i = 0; i < 4; ++i)
+    if (stats)
     {
-        if (ext[i] == '\0')
-            break;
-        dst[i] = tolower(ext[i]);
+        for (int i = 1; i < lod->levels_count; ++i)
+        {
+            fprintf(stderr, "NOTE: Level of detail %d has %u faces, error %.4f.\n", i,
+                    lod->levels[i]->faces_count, lod->errors[i]);
+        }
     }
+    return lod;
+}
+
+// Replace the vertexes and faces of the model by a compact copy, that is drawn instead.
+static struct compact_model *make_compact_model(struct model *model, bool stats)
+{
+    struct compact_model *compact = compact_model_init(model);
+
+    if (stats)
+    {
+        size_t full_bytes = model->vertex_count * sizeof(*model->vertexes)
+                + model->faces_count * sizeof(*model->faces);
+        fprintf(stderr, "NOTE: Compact model uses %.2f MB instead of %.2f MB.\n",
+                compact_model_bytes(compact) / 1e6, full_bytes / 1e6);
+    }
+
+    model_release_geometry(model);
+    return compact;
+}
+
+// Add the newly loaded part to the preview, or replace it by the whole model once it is loaded.
+// Returns false if the loading failed.
+static bool update_loading_model(struct load_job **job, struct model **model,
+        struct compact_model **compact, struct lod_chain **lod, struct surface **surface,
+        const struct arguments *args)
+{
+    if (load_job_finished(*job))
+    {
+        struct model *loaded = load_job_finish(*job);
+        *job = NULL;
+        if (!loaded)
+            return false;
+
+        prepare_model(loaded, 0, 0, args);
+        model_free(*model);
+        *model = loaded;
+
+        // The surface was sized with the estimated bounds
+        surface_free(*surface);
+        *surface = create_surface(model_xz_rad(*model), args->surface_width, args->surface_height,
+                args->aspect_ratio, args->stretch);
+        if (!*surface)
+            return false;
+
+        // The levels of detail are made before the compact copy releases the model
+        if (args->lod)
+            *lod = make_lod_chain(*model, args, false);
+        if (args->compact)
+            *compact = make_compact_model(*model, false);
+
+        if (args->color_support)
+            terminal_init_colors(*model);
+        return true;
+    }
+
+    unsigned int first_vertex = (*model)->vertex_count;
+    unsigned int first_face = (*model)->faces_count;
+    unsigned int materials_count = (*model)->materials_count;
+
+    if (load_job_update_preview(*job, *model))
+    {
+        prepare_model(*model, first_vertex, first_face, args);
+
+        if (args->color_support && (*model)->materials_count != materials_count)
+            terminal_init_colors(*model);
+    }
+    return true;
+}
+
+// Frame of the animation to draw, and what it is drawn with.
+struct animation_frame
+{
+    int t;
+    unsigned long long frame_duration;
+    struct draw_buffers *buffers;
+    const struct model *model;
+    const struct compact_model *compact;
+    const struct lod_chain *lod;
+    const struct arguments *args;
+};
+
+static void draw_animation_frame(void *data, struct surface *surface)
+{
+    const struct animation_frame *frame = data;
+    const struct arguments *args = frame->args;
+
+    surface_clear(surface);
+
+    float time = frame->t * (frame->frame_duration / 1000000.0);
+
+    const float az_speed = 2.0;
+    const float al_speed = GOLDEN_RATIO * 0.25;
+    float azimuth = az_speed * time;
+    float altitude = (args->top_elevation ? 0.25 : 0.125) * PI * (1 - sinf(al_speed * time));
+    float zoom = args->zoom / 100.0;
+
+    surface_draw_model(surface, frame->buffers, frame->model, frame->compact, frame->lod, azimuth, altitude,
+            zoom, args->static_light, args->lum_chars, args->color_support);
+}
+
+// Surface of the same size as the given one, reusing the previous one if it is.
+static struct surface *surface_like(struct surface *previous, const struct surface *surface)
+{
+    if (previous && previous->size_x == surface->size_x && previous->size_y == surface->size_y &&
+            previous->logical_size_x == surface->logical_size_x &&
+            previous->logical_size_y == surface->logical_size_y)
+        return previous;
+
+    if (previous)
+        surface_free(previous);
+    return surface_init(surface->size_x, surface->size_y, surface->logical_size_x,
+            surface->logical_size_y);
+}
+
+static void print_load_status(struct load_job *job, int row)
+{
+    float fraction, megabytes_per_second;
+    load_job_status(job, &fraction, &megabytes_per_second);
+
+    move(row, 0);
+    printw("ld: %3.0f%% %.1f MB/s", 100 * fraction, megabytes_per_second);
 }
 
 int main(int argc, char *argv[])
 {
+    unsigned long long program_start = get_current_useconds();
+
     if (argc == 1)
         output_description(argc, argv);
 
@@ -559,6 +1078,10 @@ int main(int argc, char *argv[])
     args.axes_flip_faces = false;
     args.flip_faces = false;
 
+    args.weld = false;
+    args.no_weld = false;
+    args.use_cache = true;
+
     args.color_support = false;
 
     args.snap_mode = false;
@@ -567,76 +1090,95 @@ int main(int argc, char *argv[])
 
     args.interactive = false;
 
+    args.threads = 0;
+    args.stats = false;
+
     parse_arguments(argc, argv, &args);
 
-    struct model *model;
+    threads_set_count(args.threads);
 
-    char file_extension[5];
-    init_file_extension(file_extension, args.input_file);
+    struct load_options load_options;
+    load_options.color_support = args.color_support;
+    load_options.weld = args.weld;
+    load_options.no_weld = args.no_weld;
+    load_options.use_cache = args.use_cache;
 
-    if (file_extension[0] == '\0')
-    {
-        fprintf(stderr, "ERROR: Input file has no extension.\n");
-        exit(1);
-    }
-    else if (strcmp(file_extension, "obj") == 0)
-    {
-        if (!(model = model_load_from_obj(args.input_file, args.color_support)))
-            return 1;
-        model_invert_z(model); // Required by the OBJ format.
-    }
-    else if (strcmp(file_extension, "stl") == 0)
+    load_options.progress = NULL;
+
+    // The model is loaded with the orientation given by the options
+    struct model_orientation orientation;
+    for (int i = 0; i < 3; ++i)
+        orientation.axes[i] = args.axes[i];
+    orientation.axes_flip_faces = args.axes_flip_faces;
+    orientation.flip_faces = args.flip_faces;
+    orientation.invert_x = args.invert_x;
+    orientation.invert_y = args.invert_y;
+    orientation.invert_z = args.invert_z;
+    load_options.orientation = &orientation;
+
+    struct model *model;
+    // Model being loaded in the background, while a preview of the loaded part is shown.
+    struct load_job *job = NULL;
+    // Sampled positions of the model being loaded, to size the surface.
+    struct model *bounds = NULL;
+
+    if (args.progressive && !args.snap_mode)
     {
-        if (args.color_support)
+        job = load_model_start(args.input_file, &load_options);
+        if (!(bounds = wait_load_bounds(job)))
         {
-            fprintf(stderr, "WARN: Colors are not supported in STL format.\n");
+            model = load_job_finish(job);
+            job = NULL;
         }
-        if (!(model = model_load_from_stl(args.input_file)))
-            return 1;
     }
     else
     {
-        fprintf(stderr, "ERROR: Input file has unsupported extension.\n");
-        exit(1);
+        model = load_model(args.input_file, &load_options);
     }
 
-    if (model->vertex_count == 0)
+    if (job)
     {
-        fprintf(stderr, "ERROR: Could not read model vertexes.\n");
-        exit(1);
+        model = model_init();
     }
-    if (model->faces_count == 0)
+    else
     {
-        fprintf(stderr, "ERROR: Could not read model faces.\n");
-        exit(1);
-    }
-    model_normalize(model);
+        if (!model)
+            return 1;
 
-    // Change model orientation as required by the options
-    model_change_orientation(model, args.axes[0], args.axes[1], args.axes[2]);
-    if (args.axes_flip_faces)
-        model_invert_triangles(model);
+        if (args.stats)
+            print_load_stats(model, NULL);
 
-    // Flip faces as required by the options
-    if (args.flip_faces)
-        model_invert_triangles(model);
+        prepare_model(model, 0, 0, &args);
+    }
 
-    // Invert axes as required by the options
-    if (args.invert_x)
-        model_invert_x(model);
-    if (args.invert_y)
-        model_invert_y(model);
-    if (args.invert_z)
-        model_invert_z(model);
+    // Compact copy of the model drawn instead of it and its levels of detail, once it is loaded
+    struct compact_model *compact = NULL;
+    struct lod_chain *lod = NULL;
+
+    struct draw_buffers buffers = {0};
 
     // Starting curses is required to get the screen size
     struct surface *surface;
     initscr();
-    surface = create_surface(model, args.surface_width, args.surface_height, args.aspect_ratio, args.stretch);
+    surface = create_surface(model_xz_rad(job ? bounds : model), args.surface_width, args.surface_height,
+            args.aspect_ratio, args.stretch);
     endwin(); // End curses mode
     if (!surface)
         return 1;
 
+    if (bounds)
+        model_free(bounds);
+
+    if (args.lod && !job)
+        lod = make_lod_chain(model, &args, args.stats);
+    if (args.compact && !job)
+        compact = make_compact_model(model, args.stats);
+
+    // Time of the first frame, showing the model or the part of it loaded so far
+    unsigned long long first_frame = 0;
+    bool load_failed = false;
+    bool load_stats_pending = job != NULL;
+
     if (args.color_support)
     {
         if (has_colors() == FALSE)
@@ -666,17 +1208,17 @@ int main(int argc, char *argv[])
         float azimuth = PI * args.azimuth / 180.0;
         float altitude = PI * args.altitude / 180.0;
         float zoom = args.zoom / 100.0;
-        surface_draw_model(surface, model, azimuth, altitude, zoom, args.static_light,
+        surface_draw_model(surface, &buffers, model, compact, lod, azimuth, altitude, zoom, args.static_light,
                 args.lum_chars, args.color_support);
 
         surface_print(stdout, surface);
+        first_frame = get_current_useconds();
     }
     else if (args.interactive)
     {
         initscr();
         noecho();
         curs_set(0);
-        timeout(-1);
         keypad(stdscr, TRUE); // read special keys.
 
         const float angle_move = 15.0;
@@ -688,12 +1230,18 @@ int main(int argc, char *argv[])
 
         while (1)
         {
+            if (job && !update_loading_model(&job, &model, &compact, &lod, &surface, &args))
+            {
+                load_failed = true;
+                break;
+            }
+
             surface_clear(surface);
 
             float azimuth = PI * azimuth_deg / 180;
             float altitude = PI * altitude_deg / 180;
 
-            surface_draw_model(surface, model, azimuth, altitude, zoom / 100.0,
+            surface_draw_model(surface, &buffers, model, compact, lod, azimuth, altitude, zoom / 100.0,
                     args.static_light, args.lum_chars, args.color_support);
 
             // Print surface
@@ -707,16 +1255,24 @@ int main(int argc, char *argv[])
                 printw("az: %3.0f", azimuth_deg);
                 move(2, 0);
                 printw("al: %3.0f", altitude_deg);
+                if (job)
+                    print_load_status(job, 3);
             }
             refresh();
+            if (!first_frame)
+                first_frame = get_current_useconds();
 
+            // Keep updating the model while it is being loaded
+            timeout(job ? frame_duration / 1000 : -1);
             int key = getch();
+            if (key == ERR)
+                continue;
 
             if (key == KEY_RESIZE)
             {
                 surface_free(surface);
-                surface = create_surface(model, args.surface_width, args.surface_height,
-                        args.aspect_ratio, args.stretch);
+                surface = create_surface(compact ? compact_model_xz_rad(compact) : model_xz_rad(model),
+                        args.surface_width, args.surface_height, args.aspect_ratio, args.stretch);
                 if (!surface)
                     return 1;
             }
@@ -763,26 +1319,53 @@ int main(int argc, char *argv[])
         curs_set(0);
         timeout(0);
 
+        // With more than a thread, the next frame is drawn on the back surface while the current
+        // one is printed, once the model is loaded
+        struct render_thread *render = NULL;
+        struct surface *back = NULL;
+        struct animation_frame frame = {.frame_duration = frame_duration, .buffers = &buffers,
+                .args = &args};
+        if (threads_get_count() > 1)
+            render = render_thread_start(draw_animation_frame, &frame);
+        bool next_drawn = false;
+
         int t = 0;
         while (1)
         {
-            surface_clear(surface);
-
-            float time = t * (frame_duration / 1000000.0);
+            if (job && !update_loading_model(&job, &model, &compact, &lod, &surface, &args))
+            {
+                load_failed = true;
+                break;
+            }
 
-            const float az_speed = 2.0;
-            const float al_speed = GOLDEN_RATIO * 0.25;
-            float azimuth = az_speed * time;
-            float altitude = (args.top_elevation ? 0.25 : 0.125) * PI * (1 - sinf(al_speed * time));
-            float zoom = args.zoom / 100.0;
+            if (next_drawn)
+            {
+                back = surface;
+                surface = render_thread_wait(render);
+            }
+            else
+            {
+                frame = (struct animation_frame){t, frame_duration, &buffers, model, compact, lod, &args};
+                draw_animation_frame(&frame, surface);
+            }
 
-            surface_draw_model(surface, model, azimuth, altitude, zoom, args.static_light,
-                    args.lum_chars, args.color_support);
+            next_drawn = render && !job;
+            if (next_drawn)
+            {
+                back = surface_like(back, surface);
+                frame = (struct animation_frame){t + 1, frame_duration, &buffers, model, compact, lod,
+                        &args};
+                render_thread_draw(render, back);
+            }
 
             // Print surface
             move(0, 0);
             surface_printw(surface);
+            if (job)
+                print_load_status(job, 0);
             refresh();
+            if (!first_frame)
+                first_frame = get_current_useconds();
 
             if ((args.finite && clock - start >= duration))
                 break;
@@ -790,8 +1373,15 @@ int main(int argc, char *argv[])
             int key = getch();
             if (key == KEY_RESIZE)
             {
+                // The next frame has the previous size
+                if (next_drawn)
+                {
+                    render_thread_wait(render);
+                    next_drawn = false;
+                }
                 surface_free(surface);
-                surface = create_surface(model, args.surface_width, args.surface_height, args.aspect_ratio, args.stretch);
+                surface = create_surface(compact ? compact_model_xz_rad(compact) : model_xz_rad(model),
+                        args.surface_width, args.surface_height, args.aspect_ratio, args.stretch);
                 if (!surface)
                     return 1;
             }
@@ -805,10 +1395,41 @@ int main(int argc, char *argv[])
             t++;
         }
 
+        if (render)
+            render_thread_stop(render);
+        if (back)
+            surface_free(back);
+
         endwin();
     }
 
+    if (load_failed)
+    {
+        fprintf(stderr, "ERROR: Failed to load the model.\n");
+        return 1;
+    }
+
+    if (job)
+    {
+        load_job_cancel(job);
+    }
+    else if (args.stats)
+    {
+        if (load_stats_pending)
+            print_load_stats(model, compact);
+        fprintf(stderr, "NOTE: First frame after %.3f s.\n", (first_frame - program_start) / 1e6);
+        fprintf(stderr, "NOTE: Occlusion culling rejected %llu of %llu triangles tested (%.1f%%).\n",
+                buffers.occlusion_rejects, buffers.occlusion_tests,
+                buffers.occlusion_tests > 0 ? 100.0 * buffers.occlusion_rejects / buffers.occlusion_tests : 0.0);
+    }
+
     // Free memory
-    surface_free(surface);
+    if (surface)
+        surface_free(surface);
+    if (compact)
+        compact_model_free(compact);
+    if (lod)
+        lod_chain_free(lod);
+    draw_buffers_free(&buffers);
     model_free(model);
 }